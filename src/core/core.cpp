@@ -18,6 +18,7 @@
 */
 
 #include <algorithm>
+#include <cstring>
 #include "core.h"
 
 Core::Core(std::string &cartPath, std::function<void()> *contextFunc): aes(this), arms { ArmInterp(this, ARM11A),
@@ -109,20 +110,26 @@ void Core::resetCycles() {
 }
 
 void Core::endFrame() {
-    // Break execution at the end of a frame and count it
+    // Break execution at the end of a frame and count it along with its GPU statistics
     running.store(false);
     fpsCount++;
+    for (int i = 0; i < MAX_STATS; i++)
+        gpuTotals[i] += gpu.getStat(GpuStat(i));
 
-    // Update the save file and FPS counter every second
+    // Update the save file, FPS counter, and per-frame GPU averages every second
     std::chrono::duration<double> fpsTime = std::chrono::steady_clock::now() - lastFpsTime;
     if (fpsTime.count() >= 1.0f) {
         cartridge.updateSave();
+        for (int i = 0; i < MAX_STATS; i++)
+            gpuStats[i] = gpuTotals[i] / fpsCount;
+        memset(gpuTotals, 0, sizeof(gpuTotals));
         fps = fpsCount;
         fpsCount = 0;
         lastFpsTime = std::chrono::steady_clock::now();
     }
 
     // Handle per-frame tasks and schedule the next one
+    gpu.endFrame();
     pdc.drawFrame();
     input.updateHome();
     schedule(END_FRAME, 268111856 / 60);
@@ -154,12 +154,15 @@ public:
     Core(std::string &cartPath, std::function<void()> *contextFunc = nullptr);
     void runFrame() { (*runFunc)(this); }
     void schedule(Task task, uint64_t cycles);
+    uint64_t getGpuStat(GpuStat stat) { return gpuStats[stat]; }
 
 private:
     void (*runFunc)(Core*) = &ArmInterp::runFrame<false>;
     std::function<void()> tasks[MAX_TASKS];
     std::chrono::steady_clock::time_point lastFpsTime;
     int fpsCount = 0;
+    uint64_t gpuStats[MAX_STATS] = {};
+    uint64_t gpuTotals[MAX_STATS] = {};
 
     void resetCycles();
     void endFrame();
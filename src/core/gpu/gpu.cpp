@@ -17,9 +17,16 @@
     along with 3Beans. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+#include <vector>
+
 #include "../core.h"
 #include "gpu_render_ogl.h"
 #include "gpu_render_soft.h"
+#include "gpu_trace.h"
+
+template void GpuRender::decodeEtc1<false>(const uint8_t*, uint32_t*);
+template void GpuRender::decodeEtc1<true>(const uint8_t*, uint32_t*);
 
 const int16_t GpuRender::etc1Tables[][4] {
     { 2, 8, -2, -8 },
@@ -32,15 +39,84 @@ const int16_t GpuRender::etc1Tables[][4] {
     { 47, 183, -47, -183 }
 };
 
+// Offsets of each X and Y coordinate within a swizzled 8x8 tile
+const uint8_t GpuRender::swizzleX[] = { 0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15 };
+const uint8_t GpuRender::swizzleY[] = { 0x00, 0x02, 0x08, 0x0A, 0x20, 0x22, 0x28, 0x2A };
+
+template <bool alpha> void GpuRender::decodeEtc1(const uint8_t *src, uint32_t *dst) {
+    // Decode the four 4x4 ETC1 blocks of an 8x8 tile into row-major RGBA8 texels
+    for (int i = 0; i < 4; i++, src += (alpha ? 16 : 8)) {
+        // Read a block and get its base colors and modifier tables once for both halves
+        int32_t val1 = U8TO32(src, alpha ? 8 : 0);
+        int32_t val2 = U8TO32(src, alpha ? 12 : 4);
+        const int16_t *tbls[] = { etc1Tables[(val2 >> 5) & 0x7], etc1Tables[(val2 >> 2) & 0x7] };
+        int base[2][3];
+        if (val2 & BIT(1)) { // Differential
+            base[0][0] = ((val2 >> 27) & 0x1F) * 0x21 / 4;
+            base[0][1] = ((val2 >> 19) & 0x1F) * 0x21 / 4;
+            base[0][2] = ((val2 >> 11) & 0x1F) * 0x21 / 4;
+            base[1][0] = (((val2 >> 27) & 0x1F) + (int8_t(val2 >> 19) >> 5)) * 0x21 / 4;
+            base[1][1] = (((val2 >> 19) & 0x1F) + (int8_t(val2 >> 11) >> 5)) * 0x21 / 4;
+            base[1][2] = (((val2 >> 11) & 0x1F) + (int8_t(val2 >> 3) >> 5)) * 0x21 / 4;
+        }
+        else { // Individual
+            base[0][0] = ((val2 >> 28) & 0xF) * 0x11;
+            base[0][1] = ((val2 >> 20) & 0xF) * 0x11;
+            base[0][2] = ((val2 >> 12) & 0xF) * 0x11;
+            base[1][0] = ((val2 >> 24) & 0xF) * 0x11;
+            base[1][1] = ((val2 >> 16) & 0xF) * 0x11;
+            base[1][2] = ((val2 >> 8) & 0xF) * 0x11;
+        }
+
+        // Decode each texel, which is stored in column-major order within the block
+        uint32_t *out = &dst[(i >> 1) * 32 + (i & 0x1) * 4];
+        for (int idx = 0; idx < 16; idx++) {
+            int x = (idx >> 2), y = (idx & 0x3);
+            int j = ((((val2 & BIT(0)) ? y : x) < 2) ? 0 : 1);
+            int tbl = tbls[j][((val1 >> (idx + 15)) & 0x2) | ((val1 >> idx) & 0x1)];
+            int r = std::min(0xFF, std::max(0, base[j][0] + tbl));
+            int g = std::min(0xFF, std::max(0, base[j][1] + tbl));
+            int b = std::min(0xFF, std::max(0, base[j][2] + tbl));
+            int a = alpha ? (((src[idx >> 1] >> ((idx & 0x1) * 4)) & 0xF) * 0x11) : 0xFF;
+            out[y * 8 + x] = (r << 24) | (g << 16) | (b << 8) | a;
+        }
+    }
+}
+
+uint64_t GpuRender::hashData(const uint8_t *data, uint32_t size) {
+    // Hash data in 4 independent lanes so the multiplies can overlap
+    uint64_t lanes[4] = { 0xCBF29CE484222325, 0x84222325CBF29CE4, 0x9E3779B97F4A7C15, 0x7F4A7C159E3779B9 };
+    uint32_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            uint64_t value;
+            memcpy(&value, &data[i + j * 8], sizeof(value));
+            lanes[j] = (lanes[j] ^ value) * 0x100000001B3;
+        }
+    }
+
+    // Hash any remaining bytes and combine the lanes
+    for (; i < size; i++)
+        lanes[0] = (lanes[0] ^ data[i]) * 0x100000001B3;
+    return lanes[0] ^ (lanes[1] << 16 | lanes[1] >> 48) ^ (lanes[2] << 32 | lanes[2] >> 32) ^ (lanes[3] << 48 | lanes[3] >> 16);
+}
+
 Gpu::Gpu(Core *core, std::function<void()> *contextFunc): core(core), contextFunc(contextFunc) {
     // Initialize the renderer
     createRender();
+
+    // Allow skipping unchanged writes for commands that only hold state
+    memset(cmdSkip, true, sizeof(cmdSkip));
+    for (int i = 0; volatileCmds[i][1]; i++)
+        memset(&cmdSkip[volatileCmds[i][0]], false, volatileCmds[i][1] - volatileCmds[i][0] + 1);
 }
 
 Gpu::~Gpu() {
     // Finish and clean up
     syncRender();
     destroyRender();
+    delete trace;
+    delete replay;
 }
 
 void Gpu::createRender() {
@@ -53,7 +129,8 @@ void Gpu::createRender() {
 }
 
 void Gpu::destroyRender() {
-    // Clean up the initialized renderer
+    // Clean up the initialized renderer and the vertex threads that reference it
+    stopVtxThreads();
     if (curRenderer == 1) (*contextFunc)();
     delete gpuShader, delete gpuRender;
     if (curRenderer == 1) (*contextFunc)();
@@ -63,6 +140,9 @@ void Gpu::syncRender() {
     // Stop the GPU thread or release context on this thread depending on settings
     if (running.exchange(false)) {
         if (thread) {
+            mutex.lock();
+            cond.notify_one();
+            mutex.unlock();
             thread->join();
             delete thread;
             thread = nullptr;
@@ -79,6 +159,66 @@ void Gpu::syncRender() {
 
     // Restore the renderer state
     if (curRenderer == 1) (*contextFunc)();
+    restoreState();
+    gpuRender->setFrameSkip(frameSkip);
+    for (std::set<uint32_t>::iterator it = displaySrcs.begin(); it != displaySrcs.end(); it++)
+        gpuRender->addDisplaySrc(*it);
+    if (curRenderer == 1) (*contextFunc)();
+}
+
+void Gpu::startVtxThreads() {
+    // Create a buffered shader and thread for each vertex worker, leaving a core for the thread splitting batches
+    vtxWorkers = std::min<int>(MAX_VTX_THREADS, std::max<int>(std::thread::hardware_concurrency(), 2) - 1);
+    vtxRunning = true;
+    vtxJob = 0;
+    for (int i = 0; i < vtxWorkers; i++) {
+        vtxShaders[i] = new GpuShaderInterp(*gpuRender);
+        vtxShaders[i]->setBuffered(true);
+        vtxThreads[i] = new std::thread(&Gpu::runVtxThread, this, i);
+    }
+}
+
+void Gpu::stopVtxThreads() {
+    // Signal the vertex threads to stop and clean them up
+    if (!vtxWorkers) return;
+    vtxMutex.lock();
+    vtxRunning = false;
+    vtxCond.notify_all();
+    vtxMutex.unlock();
+    for (int i = 0; i < vtxWorkers; i++) {
+        vtxThreads[i]->join();
+        delete vtxThreads[i];
+        delete vtxShaders[i];
+    }
+    vtxWorkers = 0;
+}
+
+void Gpu::runVtxThread(int i) {
+    // Sleep until a batch is split or the thread is stopped, taking the split together with the job number
+    uint32_t job = 0, total;
+    uint8_t chunks;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(vtxMutex);
+            vtxCond.wait(lock, [&] { return vtxJob != job || !vtxRunning; });
+            if (!vtxRunning) return;
+            job = vtxJob;
+            total = vtxTotal;
+            chunks = vtxChunks;
+        }
+
+        // Shade this thread's chunk of the batch if it has one, and signal when all chunks are done
+        if (i + 1 >= chunks) continue;
+        uint32_t start = uint64_t(total) * (i + 1) / chunks;
+        drawAttrRange(vtxShaders[i], start, uint64_t(total) * (i + 2) / chunks);
+        if (vtxPending.fetch_sub(1) != 1) continue;
+        std::lock_guard<std::mutex> guard(vtxMutex);
+        vtxDone.notify_one();
+    }
+}
+
+void Gpu::restoreState() {
+    // Send the current register state to the renderer
     writeFaceCulling(0xFFFFFFFF, gpuFaceCulling);
     writeViewScaleH(0xFFFFFFFF, gpuViewScaleH);
     writeViewStepH(0xFFFFFFFF, gpuViewStepH);
@@ -139,9 +279,8 @@ void Gpu::syncRender() {
     writeColbufLoc(0xFFFFFFFF, gpuColbufLoc);
     writeBufferDim(0xFFFFFFFF, gpuBufferDim);
     writePrimRestart(0xFFFFFFFF, gpuPrimRestart);
-    if (curRenderer == 1) (*contextFunc)();
 
-    // Restore the shader state
+    // Send the current shader state to the shader
     writeGshConfig(0xFFFFFFFF, gpuGshConfig);
     writeVshOutTotal(0xFFFFFFFF, gpuVshOutTotal);
     writeGshBools(0xFFFFFFFF, gpuGshBools);
@@ -170,64 +309,377 @@ void Gpu::runThreaded() {
 
     // Process GPU thread tasks
     while (true) {
-        // Wait for more tasks or finish and release context if stopped
-        while (tasks.empty()) {
+        // Sleep until more tasks are submitted, or finish and release context if stopped
+        uint32_t tail = ringTail.load(std::memory_order_relaxed);
+        if (ringHead.load(std::memory_order_acquire) == tail) {
             if (!running.load()) {
+                if (ringHead.load() != tail) continue;
                 if (curRenderer == 1) (*contextFunc)();
                 return;
             }
-            std::this_thread::yield();
+            ringWaiting.store(true);
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return ringHead.load() != tail || !running.load(); });
+            ringWaiting.store(false);
+            continue;
         }
 
-        // Get and pop the next task from the queue
-        mutex.lock();
-        GpuThreadTask task = tasks.front();
-        tasks.pop();
-        mutex.unlock();
-
-        // Handle the task based on its type
-        switch (task.type) {
+        // Handle the next task in the ring based on its type
+        switch (ring[tail++ & 0xFFFF]) {
         case TASK_CMD: {
             // Decode a GPU command header
-            uint32_t *cmds = (uint32_t*)task.data;
-            uint8_t count = (cmds[0] >> 20) & 0xFF;
-            uint32_t mask = maskTable[(cmds[0] >> 16) & 0xF];
-            uint16_t cmd = (cmds[0] & 0x3FF);
+            uint32_t header = ring[tail++ & 0xFFFF];
+            uint8_t count = (header >> 20) & 0xFF;
+            uint32_t mask = maskTable[(header >> 16) & 0xF];
+            thrCmd = (header & 0x3FF);
+            statCounts[STAT_CMDS] += count + 1;
 
             // Write command parameters to GPU registers, with optionally increasing ID
-            (this->*cmdWrites[cmd])(mask, cmds[1]);
-            if (cmds[0] & BIT(31)) // Increasing
+            writeCmd(thrCmd, mask, ring[tail++ & 0xFFFF]);
+            if (header & BIT(31)) // Increasing
                 for (int i = 0; i < count; i++)
-                    (this->*cmdWrites[++cmd & 0x3FF])(mask, cmds[i + 2]);
+                    writeCmd(++thrCmd & 0x3FF, mask, ring[tail++ & 0xFFFF]);
             else // Fixed
                 for (int i = 0; i < count; i++)
-                    (this->*cmdWrites[cmd])(mask, cmds[i + 2]);
-            delete[] cmds;
-            continue;
+                    writeCmd(thrCmd, mask, ring[tail++ & 0xFFFF]);
+            break;
         }
 
         case TASK_FILL: {
             // Start a GPU fill using saved register values
-            GpuFillRegs *regs = (GpuFillRegs*)task.data;
-            startFill(*regs);
-            delete regs;
-            continue;
+            GpuFillRegs regs;
+            for (uint32_t i = 0; i < sizeof(regs) / 4; i++)
+                ((uint32_t*)&regs)[i] = ring[tail++ & 0xFFFF];
+            startFill(regs);
+            break;
         }
 
         case TASK_COPY: {
             // Start a GPU copy using saved register values
-            GpuCopyRegs *regs = (GpuCopyRegs*)task.data;
-            startCopy(*regs);
-            delete regs;
+            GpuCopyRegs regs;
+            for (uint32_t i = 0; i < sizeof(regs) / 4; i++)
+                ((uint32_t*)&regs)[i] = ring[tail++ & 0xFFFF];
+            startCopy(regs);
+            break;
+        }
+
+        case TASK_SKIP:
+            // Tell the renderer whether the upcoming frame will be presented
+            gpuRender->setFrameSkip(ring[tail++ & 0xFFFF]);
+            break;
+
+        case TASK_TRACE:
+            // Mark the end of a frame for trace capture, and start or stop it if requested
+            updateTrace(ring[tail++ & 0xFFFF]);
+            break;
+
+        case TASK_STATS:
+            // Publish the statistics counted for the frame that just ended
+            updateStats();
+            break;
+
+        case TASK_FORGET:
+            // Stop tracking a register value that the CPU wrote directly
+            forgetCmd(ring[tail++ & 0xFFFF]);
+            break;
+
+        case TASK_DISPLAY:
+            // Tell the renderer about a color buffer that gets copied to the screen
+            gpuRender->addDisplaySrc(ring[tail++ & 0xFFFF]);
+            break;
+        }
+
+        // Free the task's space and wake the submitting thread if it's waiting for it
+        ringTail.store(tail);
+        if (ringBlocked.load()) {
+            std::lock_guard<std::mutex> guard(mutex);
+            cond.notify_one();
+        }
+    }
+}
+
+void Gpu::ringReserve(uint32_t size) {
+    // Wait until the GPU thread has freed enough ring space for a task
+    ringWait(ringPos + size - 0x10000);
+}
+
+void Gpu::ringWait(uint32_t pos) {
+    // Sleep until the GPU thread has finished all tasks before a ring position
+    if (int32_t(ringTail.load(std::memory_order_acquire) - pos) >= 0) return;
+    ringBlocked.store(true);
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&] { return int32_t(ringTail.load() - pos) >= 0; });
+    ringBlocked.store(false);
+}
+
+bool Gpu::fenceFrame() {
+    // Stop the GPU thread if its settings changed so it can be restarted accordingly
+    if (curRenderer != Settings::gpuRenderer || (thread != nullptr) != Settings::threadedGpu)
+        syncRender();
+    if (!thread) return false;
+
+    // Wait for tasks from the previous frame, letting the GPU thread lag behind by up to one
+    ringWait(frameFence);
+    frameFence = ringPos;
+    return true;
+}
+
+void Gpu::ringWrite(const uint32_t *data, uint32_t size) {
+    // Copy a block of task data into the ring, splitting it if it wraps around
+    uint32_t first = std::min<uint32_t>(size, 0x10000 - (ringPos & 0xFFFF));
+    memcpy(&ring[ringPos & 0xFFFF], data, first << 2);
+    memcpy(ring, &data[first], (size - first) << 2);
+    ringPos += size;
+}
+
+void Gpu::ringSubmit() {
+    // Make written task data visible to the GPU thread and wake it if it's waiting
+    ringHead.store(ringPos);
+    if (ringWaiting.load()) {
+        std::lock_guard<std::mutex> guard(mutex);
+        cond.notify_one();
+    }
+}
+
+void Gpu::endFrame() {
+    // Handle trace capture requests and mark frame ends while capturing, forwarding to the thread if running
+    int req = traceReq.exchange(0);
+    if (req == 1) tracing = true;
+    if (req || tracing) {
+        if (!thread) {
+            updateTrace(req);
+        }
+        else {
+            ringReserve(2);
+            ring[ringPos++ & 0xFFFF] = TASK_TRACE;
+            ring[ringPos++ & 0xFFFF] = req;
+            ringSubmit();
+        }
+    }
+    if (req == 2) tracing = false;
+
+    // Publish the statistics counted for this frame, forwarding it to the thread if running
+    if (!thread) return updateStats();
+    ringReserve(1);
+    ring[ringPos++ & 0xFFFF] = TASK_STATS;
+    ringSubmit();
+}
+
+void Gpu::writeIoCmd(uint16_t cmd) {
+    // Ignore IRQ and jump registers, which are never tracked and only affect the CPU side
+    if (cmd < 0x40 || (cmd >= 0x238 && cmd <= 0x23D)) return;
+
+    // Forget a register value written through I/O so command lists can't skip the next write to it
+    if (!thread) return forgetCmd(cmd);
+    ringReserve(2);
+    ring[ringPos++ & 0xFFFF] = TASK_FORGET;
+    ring[ringPos++ & 0xFFFF] = cmd;
+    ringSubmit();
+}
+
+void Gpu::forgetCmd(uint16_t cmd) {
+    // Mark a register's value as unknown so the next command write to it always goes through
+    cmdKnown[cmd] = 0;
+
+    // Record the registers again in a trace being captured, since the write bypassed command lists
+    if (trace) syncTraceState(false);
+}
+
+void Gpu::updateStats() {
+    // Collect counters kept by the shader and make the frame's totals visible to other threads
+    statCounts[STAT_VTX_HITS] += gpuShader->vtxHits;
+    statCounts[STAT_INSTRS] += gpuShader->instrCount;
+    statCounts[STAT_SHADE_TIME] += gpuShader->shadeTime;
+    gpuShader->vtxHits = gpuShader->vtxMisses = 0;
+    gpuShader->instrCount = gpuShader->shadeTime = 0;
+    for (int i = 0; i < MAX_STATS; i++)
+        frameStats[i].store(statCounts[i], std::memory_order_relaxed);
+
+    // Log a summary of the frame and reset the counters for the next one
+    LOG_INFO("GPU frame: %llu commands, %llu vertices, %llu triangles, %llu fragments\n",
+        (unsigned long long)statCounts[STAT_CMDS], (unsigned long long)statCounts[STAT_VERTS],
+        (unsigned long long)statCounts[STAT_TRIS], (unsigned long long)statCounts[STAT_FRAGS]);
+    memset(statCounts, 0, sizeof(statCounts));
+}
+
+uint64_t Gpu::statClock() {
+    // Get a timestamp in nanoseconds for measuring stages, or zero if statistics aren't shown
+    if (!Settings::gpuStats) return 0;
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+void Gpu::skipFrame(bool skip) {
+    // Update whether the next frame will be presented, forwarding it to the thread if running
+    if (frameSkip == skip) return;
+    frameSkip = skip;
+    if (!thread) return gpuRender->setFrameSkip(skip);
+    ringReserve(2);
+    ring[ringPos++ & 0xFFFF] = TASK_SKIP;
+    ring[ringPos++ & 0xFFFF] = skip;
+    ringSubmit();
+}
+
+void Gpu::startTrace(std::string path) {
+    // Request a trace capture to start at the end of the current frame
+    tracePath = path;
+    traceReq.store(1);
+}
+
+void Gpu::stopTrace() {
+    // Request a trace capture to stop at the end of the current frame
+    traceReq.store(2);
+}
+
+void Gpu::updateTrace(int req) {
+    // Mark the end of a frame in the trace being captured
+    if (trace) trace->writeRecord(TRACE_FRAME, nullptr, 0);
+
+    // Finish the trace if requested
+    if (req == 2 && trace) {
+        LOG_INFO("Finished GPU trace with %d frames\n", trace->frames);
+        delete trace;
+        trace = nullptr;
+        return;
+    }
+
+    // Start a new trace if requested, beginning with the state that later commands build on
+    if (req != 1 || trace) return;
+    trace = new GpuTrace(core);
+    if (trace->openWrite(tracePath)) {
+        LOG_INFO("Starting GPU trace at %s\n", tracePath.c_str());
+        syncTraceState(false);
+        return;
+    }
+    LOG_WARN("Failed to create GPU trace file: %s\n", tracePath.c_str());
+    delete trace;
+    trace = nullptr;
+}
+
+bool Gpu::syncTraceState(bool load) {
+    // List the state that commands in a trace build on, with registers declared contiguously as one block
+    const struct { void *data; uint32_t size; } blocks[] = {
+        { gpuIrqReq, uint32_t((uint8_t*)(&gpuVshDescIdx + 1) - (uint8_t*)gpuIrqReq) },
+        { attrFixedData, sizeof(attrFixedData) },
+        { vshCode, sizeof(vshCode) }, { vshDesc, sizeof(vshDesc) }, { vshFloats, sizeof(vshFloats) },
+        { gshCode, sizeof(gshCode) }, { gshDesc, sizeof(gshDesc) }, { gshFloats, sizeof(gshFloats) }
+    };
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+        size += blocks[i].size;
+
+    // Write the state to the trace being captured
+    if (!load) {
+        trace->writeRecord(TRACE_STATE, &size, sizeof(size));
+        for (uint32_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+            trace->writeData(blocks[i].data, blocks[i].size);
+        return true;
+    }
+
+    // Read the state from a replay if its layout matches this build
+    uint32_t check;
+    if (!replay->readData(&check, sizeof(check)) || check != size) {
+        LOG_CRIT("GPU trace state doesn't match this build\n");
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+        if (!replay->readData(blocks[i].data, blocks[i].size)) return false;
+
+    // Apply the state and forget about known register values
+    restoreState();
+    memset(cmdKnown, 0, sizeof(cmdKnown));
+    attrDirty = fixedDirty = true;
+    return true;
+}
+
+void Gpu::traceTextures() {
+    // Record the contents of each texture with a known format so replays can sample them
+    static const uint8_t bits[] = { 32, 24, 16, 16, 16, 16, 16, 8, 8, 8, 4, 4, 4, 8 };
+    for (int i = 0; i < 3; i++) {
+        if (gpuTexType[i] >= 0xE) continue;
+        uint32_t size = (gpuTexDim[i] >> 16) * (gpuTexDim[i] & 0x7FF) * bits[gpuTexType[i]] / 8;
+        trace->writeMemory(gpuTexAddr1[i] << 3, size, false);
+    }
+}
+
+bool Gpu::openReplay(std::string path) {
+    // Open a trace to be replayed in place of running GPU commands
+    delete replay;
+    replay = new GpuTrace(core);
+    if (replay->openRead(path)) return true;
+    delete replay;
+    replay = nullptr;
+    return false;
+}
+
+bool Gpu::replayFrame() {
+    // Handle records from the replay until the end of a frame is reached
+    uint32_t type;
+    while (replay && replay->readType(type)) {
+        switch (type) {
+        case TRACE_STATE:
+            // Load the state that the rest of the trace builds on
+            if (!syncTraceState(true)) return false;
+            continue;
+
+        case TRACE_CMD: {
+            // Decode a recorded command in the same way as the GPU thread does
+            uint32_t header, values[0x100];
+            if (!replay->readData(&header, sizeof(header))) return false;
+            uint8_t count = (header >> 20) & 0xFF;
+            uint32_t mask = maskTable[(header >> 16) & 0xF];
+            uint16_t cmd = (header & 0x3FF);
+            if (!replay->readData(values, (count + 1) << 2)) return false;
+
+            // Write command parameters to GPU registers, with optionally increasing ID
+            writeCmd(cmd, mask, values[0]);
+            for (int i = 1; i <= count; i++)
+                writeCmd((header & BIT(31)) ? (++cmd & 0x3FF) : cmd, mask, values[i]);
+            continue;
+        }
+
+        case TRACE_FILL: {
+            // Start a GPU fill using recorded register values
+            GpuFillRegs regs;
+            if (!replay->readData(&regs, sizeof(regs))) return false;
+            startFill(regs);
+            continue;
+        }
+
+        case TRACE_COPY: {
+            // Start a GPU copy using recorded register values
+            GpuCopyRegs regs;
+            if (!replay->readData(&regs, sizeof(regs))) return false;
+            startCopy(regs);
             continue;
-        }}
+        }
+
+        case TRACE_MEM:
+            // Restore memory contents that upcoming commands rely on
+            if (!replay->readMemory()) return false;
+            continue;
+
+        case TRACE_FRAME:
+            // Finish rendering the frame and stop here
+            gpuRender->flushBuffers();
+            return true;
+
+        default:
+            // Stop on unknown records, which likely means the trace is corrupt
+            LOG_CRIT("Unknown GPU trace record type: %d\n", type);
+            return false;
+        }
     }
+    return false;
 }
 
 bool Gpu::checkInterrupt(int i) {
     // Trigger a GPU interrupt if enabled and its request/compare bytes match
     if ((gpuIrqMask & BITL(i)) || ((gpuIrqCmp[i >> 2] ^ gpuIrqReq[i >> 2]) & (0xFF << ((i & 0x3) * 8))))
         return false;
+
+    // Let the GPU thread finish everything queued so far, since the guest can reuse its memory after the interrupt
+    if (thread) ringWait(ringPos);
     gpuIrqStat |= BITL(i);
     core->interrupts.sendInterrupt(ARM11, 0x2D);
     return true;
@@ -255,26 +707,131 @@ uint32_t Gpu::getDispDstOfs(uint32_t x, uint32_t y, uint32_t width) {
     return ofs | ((x << 2) & 0x10) | ((x << 1) & 0x4) | (x & 0x1);
 }
 
+uint8_t *Gpu::getCopyPtr(uint32_t address, uint32_t size, bool write, std::vector<uint8_t> &stage) {
+    // Get a host pointer to a copy range, or stage it through memory accessors if not contiguous
+    if (uint8_t *data = core->memory.getHostPtr(address, size, write)) return data;
+    stage.resize(size);
+    for (uint32_t i = 0; i < size; i++)
+        stage[i] = core->memory.read<uint8_t>(ARM11, address + i);
+    return &stage[0];
+}
+
+void Gpu::flushCopyPtr(uint32_t address, std::vector<uint8_t> &stage) {
+    // Write back a staged copy range if one was used
+    for (uint32_t i = 0; i < stage.size(); i++)
+        core->memory.write<uint8_t>(ARM11, address + i, stage[i]);
+}
+
 void Gpu::startFill(GpuFillRegs &regs) {
     // Get the start and end addresses for a GPU fill
     uint32_t start = (regs.dstAddr << 3), end = (regs.dstEnd << 3);
     LOG_INFO("Performing GPU memory fill at 0x%X with size 0x%X\n", start, end - start);
     gpuRender->flushBuffers();
+    if (trace) trace->writeRecord(TRACE_FILL, &regs, sizeof(regs));
+    if (start >= end) return;
 
-    // Perform a memory fill using the selected data width
+    // Build a 12-byte pattern that repeats every 1, 2, or 3 words based on data width
+    uint32_t pattern[3];
     switch ((regs.cnt >> 8) & 0x3) {
     case 0: // 16-bit
-        for (uint32_t addr = start; addr < end; addr += 2)
-            core->memory.write<uint16_t>(ARM11, addr, regs.data);
-        return;
+        pattern[0] = pattern[1] = pattern[2] = (regs.data & 0xFFFF) * 0x10001;
+        break;
     case 1: case 3: // 24-bit
-        for (uint32_t addr = start, val = (regs.data & 0xFFFFFF) | (regs.data << 24); addr < end; addr += 2)
-            core->memory.write<uint16_t>(ARM11, addr, val >> (((addr - start) * 8) % 24));
-        return;
+        pattern[0] = (regs.data & 0xFFFFFF) | (regs.data << 24);
+        pattern[1] = ((regs.data >> 8) & 0xFFFF) | (regs.data << 16);
+        pattern[2] = ((regs.data >> 16) & 0xFF) | (regs.data << 8);
+        break;
     case 2: // 32-bit
-        for (uint32_t addr = start; addr < end; addr += 4)
-            core->memory.write<uint32_t>(ARM11, addr, regs.data);
-        return;
+        pattern[0] = pattern[1] = pattern[2] = regs.data;
+        break;
+    }
+
+    // Fill memory with the pattern, using memset if all of its bytes are the same
+    uint64_t time = statClock();
+    std::vector<uint8_t> stage;
+    uint8_t *data = getCopyPtr(start, end - start, true, stage);
+    if (pattern[0] == pattern[1] && pattern[0] == pattern[2] && pattern[0] == (pattern[0] & 0xFF) * 0x1010101) {
+        memset(data, pattern[0], end - start);
+    }
+    else {
+        uint32_t i = 0;
+        for (; i + 12 <= end - start; i += 12)
+            memcpy(&data[i], pattern, 12);
+        memcpy(&data[i], pattern, end - start - i);
+    }
+    flushCopyPtr(start, stage);
+
+    // Count the bytes written and the time taken
+    statCounts[STAT_FILL_BYTES] += end - start;
+    if (time) statCounts[STAT_XFER_TIME] += statClock() - time;
+}
+
+template <int fmt, int scale> void Gpu::decodeRow(uint8_t (*out)[4], const uint8_t *src, const uint32_t *ofs, int width) {
+    // Decode a row of pixels to components in their native ranges, averaging them when downscaling
+    static const int n = (scale == 2) ? 4 : (scale == 1) ? 2 : 1;
+    static const int bpp = (fmt == 0) ? 4 : (fmt == 1) ? 3 : 2;
+    for (int x = 0; x < width; x++) {
+        uint32_t r = 0, g = 0, b = 0, a = 0;
+        for (int i = 0; i < n; i++) {
+            const uint8_t *p = &src[ofs[x] + i * bpp];
+            uint32_t c = (bpp == 4) ? U8TO32(p, 0) : (bpp == 2) ? U8TO16(p, 0) : 0;
+            switch (fmt) {
+            case 0: // RGBA8
+                r += (c >> 24) & 0xFF, g += (c >> 16) & 0xFF, b += (c >> 8) & 0xFF, a += c & 0xFF;
+                continue;
+            case 1: // RGB8
+                r += p[2], g += p[1], b += p[0];
+                continue;
+            case 2: // RGB565
+                r += (c >> 11) & 0x1F, g += (c >> 5) & 0x3F, b += c & 0x1F;
+                continue;
+            case 3: // RGB5A1
+                r += (c >> 11) & 0x1F, g += (c >> 6) & 0x1F, b += (c >> 1) & 0x1F, a += (c & BIT(0)) * 4;
+                continue;
+            default: // RGBA4
+                r += (c >> 12) & 0xF, g += (c >> 8) & 0xF, b += (c >> 4) & 0xF, a += c & 0xF;
+                continue;
+            }
+        }
+
+        // Store the averages, using full alpha for formats that don't have it
+        out[x][0] = r / n;
+        out[x][1] = g / n;
+        out[x][2] = b / n;
+        out[x][3] = (fmt == 1 || fmt == 2) ? 1 : (a / n);
+    }
+}
+
+template <int src, int dst> void Gpu::encodeRow(uint8_t *out, const uint8_t (*in)[4], const uint32_t *ofs, int width) {
+    // Get the component ranges of the source and destination formats, with alpha ranging 0-4 for RGB5A1
+    static const uint32_t maxs[5][4] = {
+        { 0xFF, 0xFF, 0xFF, 0xFF }, { 0xFF, 0xFF, 0xFF, 0x1 }, { 0x1F, 0x3F, 0x1F, 0x1 },
+        { 0x1F, 0x1F, 0x1F, 0x4 }, { 0xF, 0xF, 0xF, 0xF }
+    };
+
+    // Scale components between formats and encode a row of pixels
+    for (int x = 0; x < width; x++) {
+        uint32_t c[4];
+        for (int i = 0; i < 4; i++)
+            c[i] = (maxs[src][i] == maxs[dst][i]) ? in[x][i] : (in[x][i] * maxs[dst][i] / maxs[src][i]);
+        uint8_t *p = &out[ofs[x]];
+        switch (dst) {
+        case 0: // RGBA8
+            U8TO32(p, 0) = (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+            continue;
+        case 1: // RGB8
+            p[2] = c[0], p[1] = c[1], p[0] = c[2];
+            continue;
+        case 2: // RGB565
+            U8TO16(p, 0) = (c[0] << 11) | (c[1] << 5) | c[2];
+            continue;
+        case 3: // RGB5A1
+            U8TO16(p, 0) = (c[0] << 11) | (c[1] << 6) | (c[2] << 1) | bool(in[x][3]);
+            continue;
+        default: // RGBA4
+            U8TO16(p, 0) = (c[0] << 12) | (c[1] << 8) | (c[2] << 4) | c[3];
+            continue;
+        }
     }
 }
 
@@ -292,26 +849,49 @@ void Gpu::startCopy(GpuCopyRegs &regs) {
         uint32_t dstWidth = (regs.texDstWidth << 4) & 0xFFFF0;
         uint32_t dstGap = (regs.texDstWidth >> 12) & 0xFFFF0;
         LOG_INFO("Performing GPU texture copy from 0x%X to 0x%X with size 0x%X\n", srcAddr, dstAddr, gpuCopy.texSize);
-
-        // Perform a texture copy, applying address gaps when widths are reached
-        for (uint32_t i = 0; i < regs.texSize; i += 4) {
-            core->memory.write<uint32_t>(ARM11, dstAddr + i, core->memory.read<uint32_t>(ARM11, srcAddr + i));
-            if (srcWidth && !((i + 4) % srcWidth)) srcAddr += srcGap;
-            if (dstWidth && !((i + 4) % dstWidth)) dstAddr += dstGap;
+        if (!regs.texSize) return;
+
+        // Get pointers covering the source and destination, including gaps
+        uint64_t time = statClock();
+        std::vector<uint8_t> srcStage, dstStage;
+        uint32_t srcSize = regs.texSize + (srcWidth ? ((regs.texSize - 1) / srcWidth * srcGap) : 0);
+        uint32_t dstSize = regs.texSize + (dstWidth ? ((regs.texSize - 1) / dstWidth * dstGap) : 0);
+        if (trace) {
+            trace->writeMemory(srcAddr, srcSize, true);
+            trace->writeRecord(TRACE_COPY, &regs, sizeof(regs));
+        }
+        uint8_t *src = getCopyPtr(srcAddr, srcSize, false, srcStage);
+        uint8_t *dst = getCopyPtr(dstAddr, dstSize, true, dstStage);
+
+        // Copy runs of data between width boundaries, applying address gaps when they're reached
+        for (uint32_t i = 0, s = 0, d = 0; i < regs.texSize;) {
+            uint32_t size = regs.texSize - i;
+            if (srcWidth) size = std::min(size, srcWidth - i % srcWidth);
+            if (dstWidth) size = std::min(size, dstWidth - i % dstWidth);
+            memmove(&dst[d], &src[s], size);
+            i += size, s += size, d += size;
+            if (srcWidth && !(i % srcWidth)) s += srcGap;
+            if (dstWidth && !(i % dstWidth)) d += dstGap;
         }
+        flushCopyPtr(dstAddr, dstStage);
+
+        // Count the bytes written and the time taken
+        statCounts[STAT_COPY_BYTES] += regs.texSize;
+        if (time) statCounts[STAT_XFER_TIME] += statClock() - time;
         return;
     }
 
     // Get the source and destination parameters for a display copy
-    uint8_t srcFmt = (regs.flags >> 8) & 0x7;
+    uint8_t srcFmt = std::min((regs.flags >> 8) & 0x7, 4U);
     uint16_t srcWidth = (regs.flags & BIT(2)) ? regs.dispSrcSize : regs.dispDstSize;
-    uint8_t dstFmt = (regs.flags >> 12) & 0x7;
+    uint8_t dstFmt = std::min((regs.flags >> 12) & 0x7, 4U);
     uint16_t dstWidth = (regs.dispDstSize >> 0);
     uint16_t dstHeight = (regs.dispDstSize >> 16);
     uint8_t scaleType = (regs.flags >> 24) & 0x3;
 
     // Scale the destination dimensions based on scale type
-    dstWidth >>= (scaleType == 0x1 || scaleType == 0x2);
+    scaleType = (scaleType == 0x3) ? 0 : scaleType;
+    dstWidth >>= (scaleType != 0x0);
     dstHeight >>= (scaleType == 0x2);
 
     // Adjust the Y order based on the vertical flip bit
@@ -327,299 +907,84 @@ void Gpu::startCopy(GpuCopyRegs &regs) {
     if (regs.flags & BIT(16))
         LOG_CRIT("Unhandled GPU display copy tile size: 32x32\n");
 
-    // Perform an 8x8 tiled to linear display copy based on format and scale settings
-    uint8_t r, g, b, a;
-    uint32_t ofs, c0, c1, c2, c3;
-    switch (srcFmt) {
-    case 0x0: // RGBA8
-        for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
-            for (int x = 0; x < dstWidth; x++) {
-                switch (scaleType) {
-                default: // No downscale
-                    ofs = srcAddr + getDispSrcOfs(x, y0, srcWidth) * 4;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs);
-                    r = ((c0 >> 24) & 0xFF);
-                    g = ((c0 >> 16) & 0xFF);
-                    b = ((c0 >> 8) & 0xFF);
-                    a = ((c0 >> 0) & 0xFF);
-                    break;
-                case 0x1: // 2x1 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0, srcWidth) * 4;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint32_t>(ARM11, ofs + 0x4);
-                    r = (((c0 >> 24) & 0xFF) + ((c1 >> 24) & 0xFF)) / 2;
-                    g = (((c0 >> 16) & 0xFF) + ((c1 >> 16) & 0xFF)) / 2;
-                    b = (((c0 >> 8) & 0xFF) + ((c1 >> 8) & 0xFF)) / 2;
-                    a = (((c0 >> 0) & 0xFF) + ((c1 >> 0) & 0xFF)) / 2;
-                    break;
-                case 0x2: // 2x2 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0 << 1, srcWidth) * 4;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint32_t>(ARM11, ofs + 0x4);
-                    c2 = core->memory.read<uint32_t>(ARM11, ofs + 0x8);
-                    c3 = core->memory.read<uint32_t>(ARM11, ofs + 0xC);
-                    r = (((c0 >> 24) & 0xFF) + ((c1 >> 24) & 0xFF) + ((c2 >> 24) & 0xFF) + ((c3 >> 24) & 0xFF)) / 4;
-                    g = (((c0 >> 16) & 0xFF) + ((c1 >> 16) & 0xFF) + ((c2 >> 16) & 0xFF) + ((c3 >> 16) & 0xFF)) / 4;
-                    b = (((c0 >> 8) & 0xFF) + ((c1 >> 8) & 0xFF) + ((c2 >> 8) & 0xFF) + ((c3 >> 8) & 0xFF)) / 4;
-                    a = (((c0 >> 0) & 0xFF) + ((c1 >> 0) & 0xFF) + ((c2 >> 0) & 0xFF) + ((c3 >> 0) & 0xFF)) / 4;
-                    break;
-                }
-
-                switch (dstFmt) {
-                case 0x0: // RGBA8
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 4;
-                    c0 = (r << 24) | (g << 16) | (b << 8) | a;
-                    core->memory.write<uint32_t>(ARM11, ofs, c0);
-                    continue;
-                case 0x1: // RGB8
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 3;
-                    core->memory.write<uint8_t>(ARM11, ofs + 2, r);
-                    core->memory.write<uint8_t>(ARM11, ofs + 1, g);
-                    core->memory.write<uint8_t>(ARM11, ofs + 0, b);
-                    continue;
-                case 0x2: // RGB565
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 31 / 255) << 11) | ((g * 63 / 255) << 5) | (b * 31 / 255);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                case 0x3: // RGB5A1
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 31 / 255) << 11) | ((g * 31 / 255) << 6) | ((b * 31 / 255) << 1) | bool(a);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                default: // RGBA4
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 15 / 255) << 12) | ((g * 15 / 255) << 8) | ((b * 15 / 255) << 4) | (a * 15 / 255);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                }
-            }
-        }
-        return;
-
-    case 0x1: // RGB8
-        if (dstFmt != 0x1) { // RGB8
-            LOG_CRIT("Invalid destination format for RGB8 display copy: 0x%X\n", dstFmt);
-            return;
-        }
-
-        for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
-            for (int x = 0; x < dstWidth; x++) {
-                switch (scaleType) {
-                default: // No downscale
-                    ofs = srcAddr + getDispSrcOfs(x, y0, srcWidth) * 3;
-                    r = core->memory.read<uint8_t>(ARM11, ofs + 2);
-                    g = core->memory.read<uint8_t>(ARM11, ofs + 1);
-                    b = core->memory.read<uint8_t>(ARM11, ofs + 0);
-                    break;
-                case 0x1: // 2x1 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0, srcWidth) * 3;
-                    r = (core->memory.read<uint8_t>(ARM11, ofs + 2) + core->memory.read<uint8_t>(ARM11, ofs + 5)) / 2;
-                    g = (core->memory.read<uint8_t>(ARM11, ofs + 1) + core->memory.read<uint8_t>(ARM11, ofs + 4)) / 2;
-                    b = (core->memory.read<uint8_t>(ARM11, ofs + 0) + core->memory.read<uint8_t>(ARM11, ofs + 3)) / 2;
-                    break;
-                case 0x2: // 2x2 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0 << 1, srcWidth) * 3;
-                    r = (core->memory.read<uint8_t>(ARM11, ofs + 2) + core->memory.read<uint8_t>(ARM11, ofs + 5) +
-                        core->memory.read<uint8_t>(ARM11, ofs + 8) + core->memory.read<uint8_t>(ARM11, ofs + 11)) / 4;
-                    g = (core->memory.read<uint8_t>(ARM11, ofs + 1) + core->memory.read<uint8_t>(ARM11, ofs + 4) +
-                        core->memory.read<uint8_t>(ARM11, ofs + 7) + core->memory.read<uint8_t>(ARM11, ofs + 10)) / 4;
-                    b = (core->memory.read<uint8_t>(ARM11, ofs + 0) + core->memory.read<uint8_t>(ARM11, ofs + 3) +
-                        core->memory.read<uint8_t>(ARM11, ofs + 6) + core->memory.read<uint8_t>(ARM11, ofs + 9)) / 4;
-                    break;
-                }
-
-                ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 3;
-                core->memory.write<uint8_t>(ARM11, ofs + 2, r);
-                core->memory.write<uint8_t>(ARM11, ofs + 1, g);
-                core->memory.write<uint8_t>(ARM11, ofs + 0, b);
-            }
-        }
-        return;
-
-    case 0x2: // RGB565
-        for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
-            for (int x = 0; x < dstWidth; x++) {
-                switch (scaleType) {
-                default: // No downscale
-                    ofs = srcAddr + getDispSrcOfs(x, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs);
-                    r = ((c0 >> 11) & 0x1F);
-                    g = ((c0 >> 5) & 0x3F);
-                    b = ((c0 >> 0) & 0x1F);
-                    break;
-                case 0x1: // 2x1 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint16_t>(ARM11, ofs + 0x2);
-                    r = (((c0 >> 11) & 0x1F) + ((c1 >> 11) & 0x1F)) / 2;
-                    g = (((c0 >> 5) & 0x3F) + ((c1 >> 5) & 0x3F)) / 2;
-                    b = (((c0 >> 0) & 0x1F) + ((c1 >> 0) & 0x1F)) / 2;
-                    break;
-                case 0x2: // 2x2 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0 << 1, srcWidth) * 2;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint32_t>(ARM11, ofs + 0x2);
-                    c2 = core->memory.read<uint32_t>(ARM11, ofs + 0x4);
-                    c3 = core->memory.read<uint32_t>(ARM11, ofs + 0x6);
-                    r = (((c0 >> 11) & 0x1F) + ((c1 >> 11) & 0x1F) + ((c2 >> 11) & 0x1F) + ((c3 >> 11) & 0x1F)) / 4;
-                    g = (((c0 >> 5) & 0x3F) + ((c1 >> 5) & 0x3F) + ((c2 >> 5) & 0x3F) + ((c3 >> 5) & 0x3F)) / 4;
-                    b = (((c0 >> 0) & 0x1F) + ((c1 >> 0) & 0x1F) + ((c2 >> 0) & 0x1F) + ((c3 >> 0) & 0x1F)) / 4;
-                    break;
-                }
-
-                switch (dstFmt) {
-                case 0x0: // RGBA8
-                case 0x1: // RGB8
-                    LOG_CRIT("Invalid destination format for RGB565 display copy: 0x%X\n", dstFmt);
-                    return;
-                case 0x2: // RGB565
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = (r << 11) | (g << 5) | b;
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                case 0x3: // RGB5A1
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = (r << 11) | ((g * 31 / 63) << 6) | (b << 1) | 0x1;
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                default: // RGBA4
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 15 / 31) << 12) | ((g * 15 / 63) << 8) | ((b * 15 / 31) << 4) | 0xF;
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                }
-            }
-        }
-        return;
-
-    case 0x3: // RGB5A1
-        for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
-            for (int x = 0; x < dstWidth; x++) {
-                switch (scaleType) {
-                default: // No downscale
-                    ofs = srcAddr + getDispSrcOfs(x, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs);
-                    r = ((c0 >> 11) & 0x1F);
-                    g = ((c0 >> 6) & 0x1F);
-                    b = ((c0 >> 1) & 0x1F);
-                    a = (c0 & BIT(0)) * 4;
-                    break;
-                case 0x1: // 2x1 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint16_t>(ARM11, ofs + 0x2);
-                    r = (((c0 >> 11) & 0x1F) + ((c1 >> 11) & 0x1F)) / 2;
-                    g = (((c0 >> 6) & 0x1F) + ((c1 >> 6) & 0x1F)) / 2;
-                    b = (((c0 >> 1) & 0x1F) + ((c1 >> 1) & 0x1F)) / 2;
-                    a = ((c0 & BIT(0)) + (c1 & BIT(0))) * 2;
-                    break;
-                case 0x2: // 2x2 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0 << 1, srcWidth) * 2;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint32_t>(ARM11, ofs + 0x2);
-                    c2 = core->memory.read<uint32_t>(ARM11, ofs + 0x4);
-                    c3 = core->memory.read<uint32_t>(ARM11, ofs + 0x6);
-                    r = (((c0 >> 11) & 0x1F) + ((c1 >> 11) & 0x1F) + ((c2 >> 11) & 0x1F) + ((c3 >> 11) & 0x1F)) / 4;
-                    g = (((c0 >> 6) & 0x1F) + ((c1 >> 6) & 0x1F) + ((c2 >> 6) & 0x1F) + ((c3 >> 6) & 0x1F)) / 4;
-                    b = (((c0 >> 1) & 0x1F) + ((c1 >> 1) & 0x1F) + ((c2 >> 1) & 0x1F) + ((c3 >> 1) & 0x1F)) / 4;
-                    a = ((c0 & BIT(0)) + (c1 & BIT(0)) + (c2 & BIT(0)) + (c3 & BIT(0)));
-                    break;
-                }
-
-                switch (dstFmt) {
-                case 0x0: // RGBA8
-                case 0x1: // RGB8
-                    LOG_CRIT("Invalid destination format for RGB5A1 display copy: 0x%X\n", dstFmt);
-                    return;
-                case 0x2: // RGB565
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = (r << 11) | ((g * 63 / 31) << 5) | b;
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                case 0x3: // RGB5A1
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = (r << 11) | (g << 6) | (b << 1) | bool(a);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                default: // RGBA4
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 15 / 31) << 12) | ((g * 15 / 31) << 8) | ((b * 15 / 31) << 4) | (a * 15 / 4);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                }
-            }
-        }
+    // Check for format conversions that aren't supported
+    if ((srcFmt == 0x1 && dstFmt != 0x1) || (srcFmt >= 0x2 && dstFmt < 0x2)) {
+        LOG_CRIT("Invalid destination format for display copy from 0x%X: 0x%X\n", srcFmt, (regs.flags >> 12) & 0x7);
         return;
+    }
+    if (!dstWidth || !dstHeight) return;
+
+    // Build tables of pixel byte offsets within a row, since tiled offsets split into X and Y parts
+    uint64_t time = statClock();
+    static const uint8_t sizes[] = { 4, 3, 2, 2, 2 };
+    uint8_t srcSize = sizes[srcFmt], dstSize = sizes[dstFmt];
+    std::vector<uint32_t> srcOfs(dstWidth), dstOfs(dstWidth);
+    for (int x = 0; x < dstWidth; x++) {
+        srcOfs[x] = getDispSrcOfs(x << (scaleType != 0x0), 0, srcWidth) * srcSize;
+        dstOfs[x] = getDispDstOfs(x, 0, dstWidth) * dstSize;
+    }
 
-    default: // RGBA4
-        for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
-            for (int x = 0; x < dstWidth; x++) {
-                switch (scaleType) {
-                default: // No downscale
-                    ofs = srcAddr + getDispSrcOfs(x, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs);
-                    r = ((c0 >> 12) & 0xF);
-                    g = ((c0 >> 8) & 0xF);
-                    b = ((c0 >> 4) & 0xF);
-                    a = ((c0 >> 0) & 0xF);
-                    break;
-                case 0x1: // 2x1 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0, srcWidth) * 2;
-                    c0 = core->memory.read<uint16_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint16_t>(ARM11, ofs + 0x2);
-                    r = (((c0 >> 12) & 0xF) + ((c1 >> 12) & 0xF)) / 2;
-                    g = (((c0 >> 8) & 0xF) + ((c1 >> 8) & 0xF)) / 2;
-                    b = (((c0 >> 4) & 0xF) + ((c1 >> 4) & 0xF)) / 2;
-                    a = (((c0 >> 0) & 0xF) + ((c1 >> 0) & 0xF)) / 2;
-                    break;
-                case 0x2: // 2x2 downscale
-                    ofs = srcAddr + getDispSrcOfs(x << 1, y0 << 1, srcWidth) * 2;
-                    c0 = core->memory.read<uint32_t>(ARM11, ofs + 0x0);
-                    c1 = core->memory.read<uint32_t>(ARM11, ofs + 0x2);
-                    c2 = core->memory.read<uint32_t>(ARM11, ofs + 0x4);
-                    c3 = core->memory.read<uint32_t>(ARM11, ofs + 0x6);
-                    r = (((c0 >> 12) & 0xF) + ((c1 >> 12) & 0xF) + ((c2 >> 12) & 0xF) + ((c3 >> 12) & 0xF)) / 4;
-                    g = (((c0 >> 8) & 0xF) + ((c1 >> 8) & 0xF) + ((c2 >> 8) & 0xF) + ((c3 >> 8) & 0xF)) / 4;
-                    b = (((c0 >> 4) & 0xF) + ((c1 >> 4) & 0xF) + ((c2 >> 4) & 0xF) + ((c3 >> 4) & 0xF)) / 4;
-                    a = (((c0 >> 0) & 0xF) + ((c1 >> 0) & 0xF) + ((c2 >> 0) & 0xF) + ((c3 >> 0) & 0xF)) / 4;
-                    break;
-                }
-
-                switch (dstFmt) {
-                case 0x0: // RGBA8
-                case 0x1: // RGB8
-                    LOG_CRIT("Invalid destination format for RGBA4 display copy: 0x%X\n", dstFmt);
-                    return;
-                case 0x2: // RGB565
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 31 / 15) << 11) | ((g * 63 / 15) << 5) | (b * 31 / 15);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                case 0x3: // RGB5A1
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = ((r * 31 / 15) << 11) | ((g * 31 / 15) << 6) | ((b * 31 / 15) << 1) | bool(a);
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                default: // RGBA4
-                    ofs = dstAddr + getDispDstOfs(x, y1, dstWidth) * 2;
-                    c0 = (r << 12) | (g << 8) | (b << 4) | a;
-                    core->memory.write<uint16_t>(ARM11, ofs, c0);
-                    continue;
-                }
-            }
-        }
-        return;
+    // Get pointers covering the source and destination, which have offsets that increase with X and Y
+    std::vector<uint8_t> srcStage, dstStage;
+    uint32_t srcEnd = getDispSrcOfs(0, (dstHeight - 1) << (scaleType == 0x2), srcWidth) * srcSize;
+    uint32_t dstEnd = getDispDstOfs(0, dstHeight - 1, dstWidth) * dstSize;
+    srcEnd += srcOfs[dstWidth - 1] + (srcSize << scaleType);
+    dstEnd += dstOfs[dstWidth - 1] + dstSize;
+    if (trace) {
+        trace->writeMemory(srcAddr, srcEnd, true);
+        trace->writeRecord(TRACE_COPY, &regs, sizeof(regs));
+    }
+    uint8_t *src = getCopyPtr(srcAddr, srcEnd, false, srcStage);
+    uint8_t *dst = getCopyPtr(dstAddr, dstEnd, true, dstStage);
+
+    // Select row kernels based on formats and scale settings
+    void (*decode)(uint8_t(*)[4], const uint8_t*, const uint32_t*, int);
+    void (*encode)(uint8_t*, const uint8_t(*)[4], const uint32_t*, int);
+    static void (*decodes[])(uint8_t(*)[4], const uint8_t*, const uint32_t*, int) = {
+        &Gpu::decodeRow<0, 0>, &Gpu::decodeRow<0, 1>, &Gpu::decodeRow<0, 2>,
+        &Gpu::decodeRow<1, 0>, &Gpu::decodeRow<1, 1>, &Gpu::decodeRow<1, 2>,
+        &Gpu::decodeRow<2, 0>, &Gpu::decodeRow<2, 1>, &Gpu::decodeRow<2, 2>,
+        &Gpu::decodeRow<3, 0>, &Gpu::decodeRow<3, 1>, &Gpu::decodeRow<3, 2>,
+        &Gpu::decodeRow<4, 0>, &Gpu::decodeRow<4, 1>, &Gpu::decodeRow<4, 2>
+    };
+    static void (*encodes[])(uint8_t*, const uint8_t(*)[4], const uint32_t*, int) = {
+        &Gpu::encodeRow<0, 0>, &Gpu::encodeRow<0, 1>, &Gpu::encodeRow<0, 2>, &Gpu::encodeRow<0, 3>,
+        &Gpu::encodeRow<0, 4>, nullptr, &Gpu::encodeRow<1, 1>, nullptr, nullptr, nullptr, nullptr, nullptr,
+        &Gpu::encodeRow<2, 2>, &Gpu::encodeRow<2, 3>, &Gpu::encodeRow<2, 4>, nullptr, nullptr,
+        &Gpu::encodeRow<3, 2>, &Gpu::encodeRow<3, 3>, &Gpu::encodeRow<3, 4>, nullptr, nullptr,
+        &Gpu::encodeRow<4, 2>, &Gpu::encodeRow<4, 3>, &Gpu::encodeRow<4, 4>
+    };
+    decode = decodes[srcFmt * 3 + scaleType];
+    encode = encodes[srcFmt * 5 + dstFmt];
+
+    // Perform an 8x8 tiled to linear display copy one row at a time
+    std::vector<uint8_t> row(dstWidth * 4);
+    for (int y0 = yStart, y1 = 0; y1 < dstHeight; y0 += yInc, y1++) {
+        uint32_t srcRow = getDispSrcOfs(0, y0 << (scaleType == 0x2), srcWidth) * srcSize;
+        uint32_t dstRow = getDispDstOfs(0, y1, dstWidth) * dstSize;
+        (*decode)((uint8_t(*)[4])&row[0], &src[srcRow], &srcOfs[0], dstWidth);
+        (*encode)(&dst[dstRow], (uint8_t(*)[4])&row[0], &dstOfs[0], dstWidth);
     }
+    flushCopyPtr(dstAddr, dstStage);
+
+    // Count the bytes written and the time taken
+    statCounts[STAT_COPY_BYTES] += dstWidth * dstHeight * dstSize;
+    if (time) statCounts[STAT_XFER_TIME] += statClock() - time;
 }
 
 void Gpu::endFill(int i) {
+    // Wait for the GPU thread to finish the fill so the CPU can't see memory before it's done
+    if (thread) ringWait(fillFences[i]);
+
     // Trigger a GPU fill end interrupt after some time
     gpuFill[i].cnt |= BIT(1);
     core->interrupts.sendInterrupt(ARM11, 0x28 + i);
 }
 
 void Gpu::endCopy() {
+    // Wait for the GPU thread to finish the copy so the CPU can't see memory before it's done
+    if (thread) ringWait(copyFence);
+
     // Trigger a GPU copy ehd interrupt after some time
     gpuCopy.cnt |= BIT(8);
     core->interrupts.sendInterrupt(ARM11, 0x2C);
@@ -663,10 +1028,11 @@ void Gpu::writeFillCnt(int i, uint32_t mask, uint32_t value) {
 
     // Start the fill now or forward it to the thread if running
     if (!thread) return startFill(gpuFill[i]);
-    GpuFillRegs *regs = new GpuFillRegs(gpuFill[i]);
-    mutex.lock();
-    tasks.emplace(TASK_FILL, regs);
-    mutex.unlock();
+    ringReserve(sizeof(GpuFillRegs) / 4 + 1);
+    ring[ringPos++ & 0xFFFF] = TASK_FILL;
+    ringWrite((uint32_t*)&gpuFill[i], sizeof(GpuFillRegs) / 4);
+    ringSubmit();
+    fillFences[i] = ringPos;
 }
 
 void Gpu::writeCopySrcAddr(uint32_t mask, uint32_t value) {
@@ -709,12 +1075,28 @@ void Gpu::writeCopyCnt(uint32_t mask, uint32_t value) {
     core->schedule(GPU_END_COPY, (gpuCopy.flags & BIT(3)) ? (gpuCopy.texSize / 4)
         : ((gpuCopy.dispDstSize & 0xFFFF) * (gpuCopy.dispDstSize >> 16)));
 
+    // Let the renderer know the first time a color buffer gets copied to the screen
+    uint32_t srcAddr = (gpuCopy.srcAddr << 3);
+    if (!(gpuCopy.flags & BIT(3)) && core->pdc.isFramebuf(gpuCopy.dstAddr << 3)
+            && displaySrcs.insert(srcAddr).second) {
+        if (!thread) {
+            gpuRender->addDisplaySrc(srcAddr);
+        }
+        else {
+            ringReserve(2);
+            ring[ringPos++ & 0xFFFF] = TASK_DISPLAY;
+            ring[ringPos++ & 0xFFFF] = srcAddr;
+            ringSubmit();
+        }
+    }
+
     // Start the copy now or forward it to the thread if running
     if (!thread) return startCopy(gpuCopy);
-    GpuCopyRegs *regs = new GpuCopyRegs(gpuCopy);
-    mutex.lock();
-    tasks.emplace(TASK_COPY, regs);
-    mutex.unlock();
+    ringReserve(sizeof(GpuCopyRegs) / 4 + 1);
+    ring[ringPos++ & 0xFFFF] = TASK_COPY;
+    ringWrite((uint32_t*)&gpuCopy, sizeof(GpuCopyRegs) / 4);
+    ringSubmit();
+    copyFence = ringPos;
 }
 
 void Gpu::writeCopyTexSize(uint32_t mask, uint32_t value) {
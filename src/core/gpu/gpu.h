@@ -19,13 +19,22 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
 #include <mutex>
+#include <set>
+#include <string>
 #include <thread>
+#include <vector>
+
+// Maximum number of vertex worker threads, and the smallest part of a batch worth giving to one
+#define MAX_VTX_THREADS 7
+#define VTX_CHUNK_MIN 0x100
 
 class Core;
 class GpuRender;
 class GpuShaderInterp;
+class GpuTrace;
 
 enum PrimMode {
     TRIANGLES,
@@ -164,10 +173,43 @@ enum DepbufFmt {
     DEP_UNK
 };
 
+enum ClipResult {
+    CLIP_INSIDE,
+    CLIP_OUTSIDE,
+    CLIP_PARTIAL
+};
+
 enum GpuTaskType {
     TASK_CMD,
     TASK_FILL,
-    TASK_COPY
+    TASK_COPY,
+    TASK_SKIP,
+    TASK_TRACE,
+    TASK_STATS,
+    TASK_FORGET,
+    TASK_DISPLAY
+};
+
+enum GpuStat {
+    STAT_CMDS, // Command parameters processed
+    STAT_SKIPS, // Register writes skipped for being unchanged
+    STAT_VERTS, // Vertices submitted by draws
+    STAT_VTX_HITS, // Vertices reused from the shader output cache
+    STAT_INSTRS, // Shader instructions executed
+    STAT_TRIS, // Triangles assembled from vertices
+    STAT_CULLED, // Triangles culled or fully outside the view
+    STAT_CLIPPED, // Triangles partially outside the view
+    STAT_FRAGS, // Fragments generated by rasterization
+    STAT_DEPTH_PASS, // Fragments that passed the depth test
+    STAT_STENCIL_PASS, // Fragments that passed an enabled stencil test
+    STAT_TEXELS, // Texels fetched, or uploaded for OpenGL
+    STAT_TEX_HITS, // Texel lookups or textures served from a cache
+    STAT_FILL_BYTES, // Bytes written by memory fills
+    STAT_COPY_BYTES, // Bytes written by display and texture copies
+    STAT_SHADE_TIME, // Nanoseconds spent running shaders
+    STAT_DRAW_TIME, // Nanoseconds spent on draws, including software rasterization
+    STAT_XFER_TIME, // Nanoseconds spent on fills and copies
+    MAX_STATS
 };
 
 struct GpuFillRegs {
@@ -189,10 +231,20 @@ struct GpuCopyRegs {
     uint32_t texDstWidth = 0;
 };
 
-struct GpuThreadTask {
-    GpuTaskType type;
-    void *data;
-    GpuThreadTask(GpuTaskType type, void *data): type(type), data(data) {}
+struct AttrStep {
+    void (*load)(float*, const uint8_t*);
+    uint8_t id;
+    uint8_t ofs[4];
+};
+
+struct AttrArray {
+    uint32_t start;
+    uint8_t stride;
+    uint8_t size[4];
+    uint8_t step;
+    uint8_t count;
+    uint8_t *ptr;
+    uint32_t ptrBase;
 };
 
 class Gpu {
@@ -200,9 +252,21 @@ public:
     Gpu(Core *core, std::function<void()> *contextFunc);
     ~Gpu();
 
+    uint64_t statCounts[MAX_STATS] = {};
+
     void syncRender();
+    bool fenceFrame();
+    void endFrame();
+    void skipFrame(bool skip);
+    void startTrace(std::string path);
+    void stopTrace();
+    bool openReplay(std::string path);
+    bool replayFrame();
+    uint64_t getStat(GpuStat stat) { return frameStats[stat].load(std::memory_order_relaxed); }
+    static uint64_t statClock();
     void endFill(int i);
     void endCopy();
+    void writeIoCmd(uint16_t cmd);
 
     uint32_t readCfg11GpuCnt() { return cfg11GpuCnt; }
     uint32_t readFillDstAddr(int i) { return gpuFill[i].dstAddr; }
@@ -396,21 +460,70 @@ private:
     GpuRender *gpuRender = nullptr;
     int curRenderer = -1;
 
+    GpuTrace *trace = nullptr;
+    GpuTrace *replay = nullptr;
+    std::string tracePath;
+    std::atomic<int> traceReq{0};
+    bool tracing = false;
+
     static void (Gpu::*cmdWrites[0x400])(uint32_t, uint32_t);
     static uint32_t maskTable[0x10];
+    static void (*attrLoads[0x10])(float*, const uint8_t*);
+    static const uint16_t volatileCmds[][2];
+
+    uint32_t ring[0x10000] = {};
+    std::atomic<uint32_t> ringHead{0};
+    std::atomic<uint32_t> ringTail{0};
+    std::atomic<bool> ringWaiting{false};
+    std::atomic<bool> ringBlocked{false};
+    uint32_t ringPos = 0;
+    uint32_t frameFence = 0;
+    uint32_t fillFences[2] = {};
+    uint32_t copyFence = 0;
+    std::set<uint32_t> displaySrcs;
+    bool frameSkip = false;
+    uint16_t thrCmd = 0;
 
-    std::queue<GpuThreadTask> tasks;
     std::mutex mutex;
-    std::thread *thread;
+    std::condition_variable cond;
+    std::thread *thread = nullptr;
     std::atomic<bool> running{false};
 
+    GpuShaderInterp *vtxShaders[MAX_VTX_THREADS] = {};
+    std::thread *vtxThreads[MAX_VTX_THREADS] = {};
+    std::mutex vtxMutex;
+    std::condition_variable vtxCond;
+    std::condition_variable vtxDone;
+    std::atomic<int> vtxPending{0};
+    std::vector<uint32_t> vtxIdxs;
+    uint32_t vtxJob = 0;
+    uint32_t vtxFirst = 0;
+    uint32_t vtxTotal = 0;
+    uint8_t vtxChunks = 0;
+    uint8_t vtxWorkers = 0;
+    bool vtxIndexed = false;
+    bool vtxRunning = false;
+
     uint32_t cmdAddr = -1;
     uint32_t cmdEnd = 0;
+    uint32_t *cmdPtr = nullptr;
+    uint32_t cmdPtrAddr = 0;
+    uint32_t cmdPtrEnd = 0;
     uint16_t curCmd = 0;
 
+    bool cmdSkip[0x400] = {};
+    uint32_t cmdRegs[0x400] = {};
+    uint32_t cmdKnown[0x400] = {};
+    std::atomic<uint64_t> frameStats[MAX_STATS] = {};
+
     bool shdMapDirty = false;
     bool fixedDirty = false;
     float fixedBase[16][4] = {};
+    bool attrDirty = true;
+    float attrBase[16][4] = {};
+    AttrStep attrSteps[12 * 12] = {};
+    AttrArray attrArrays[12] = {};
+    uint8_t attrCount = 0;
     uint32_t attrFixedData[31][3] = {};
     uint8_t attrFixedIdx = 0;
 
@@ -500,19 +613,45 @@ private:
 
     void createRender();
     void destroyRender();
+    void restoreState();
 
     void runThreaded();
+    void startVtxThreads();
+    void stopVtxThreads();
+    void runVtxThread(int i);
+    void ringReserve(uint32_t size);
+    void ringWrite(const uint32_t *data, uint32_t size);
+    void ringSubmit();
+    void ringWait(uint32_t pos);
+    void forgetCmd(uint16_t cmd);
     bool checkInterrupt(int i);
+    void updateStats();
+
+    void updateTrace(int req);
+    bool syncTraceState(bool load);
+    void traceTextures();
 
     uint32_t getDispSrcOfs(uint32_t x, uint32_t y, uint32_t width);
     uint32_t getDispDstOfs(uint32_t x, uint32_t y, uint32_t width);
+    uint8_t *getCopyPtr(uint32_t address, uint32_t size, bool write, std::vector<uint8_t> &stage);
+    void flushCopyPtr(uint32_t address, std::vector<uint8_t> &stage);
     void startFill(GpuFillRegs &regs);
     void startCopy(GpuCopyRegs &regs);
 
+    template <int fmt, int scale> static void decodeRow(uint8_t (*out)[4], const uint8_t *src, const uint32_t *ofs, int width);
+    template <int src, int dst> static void encodeRow(uint8_t *out, const uint8_t (*in)[4], const uint32_t *ofs, int width);
+
     static uint32_t flt24e7to32e8(uint32_t value);
     static uint32_t flt32e7to32e8(uint32_t value);
 
     void runCommands();
-    void drawAttrIdx(uint32_t idx);
+    void writeCmd(uint16_t cmd, uint32_t mask, uint32_t value);
+    void resolveCmds();
+    template <typename T, int n> static void loadAttr(float *dst, const uint8_t *src);
+    void updateAttrs();
+    void resolveAttrs(uint32_t minIdx, uint32_t maxIdx);
+    void loadAttrs(float (*input)[4], uint32_t idx);
+    void drawAttrRange(GpuShaderInterp *shader, uint32_t start, uint32_t end);
+    void drawAttrs();
     void updateShdMaps();
 };
@@ -21,6 +21,7 @@
 
 #include "../core.h"
 #include "gpu_render.h"
+#include "gpu_trace.h"
 
 TEMPLATE4(void Gpu::writeIrqReq, 0, uint32_t, uint32_t)
 TEMPLATE4(void Gpu::writeIrqReq, 4, uint32_t, uint32_t)
@@ -55,6 +56,22 @@ TEMPLATE2(void Gpu::writeCmdAddr, 0, uint32_t, uint32_t)
 TEMPLATE2(void Gpu::writeCmdJump, 0, uint32_t, uint32_t)
 TEMPLATE4(void Gpu::writeGshInts, 0, uint32_t, uint32_t)
 TEMPLATE4(void Gpu::writeVshInts, 0, uint32_t, uint32_t)
+template void Gpu::loadAttr<int8_t, 1>(float*, const uint8_t*);
+template void Gpu::loadAttr<uint8_t, 1>(float*, const uint8_t*);
+template void Gpu::loadAttr<int16_t, 1>(float*, const uint8_t*);
+template void Gpu::loadAttr<float, 1>(float*, const uint8_t*);
+template void Gpu::loadAttr<int8_t, 2>(float*, const uint8_t*);
+template void Gpu::loadAttr<uint8_t, 2>(float*, const uint8_t*);
+template void Gpu::loadAttr<int16_t, 2>(float*, const uint8_t*);
+template void Gpu::loadAttr<float, 2>(float*, const uint8_t*);
+template void Gpu::loadAttr<int8_t, 3>(float*, const uint8_t*);
+template void Gpu::loadAttr<uint8_t, 3>(float*, const uint8_t*);
+template void Gpu::loadAttr<int16_t, 3>(float*, const uint8_t*);
+template void Gpu::loadAttr<float, 3>(float*, const uint8_t*);
+template void Gpu::loadAttr<int8_t, 4>(float*, const uint8_t*);
+template void Gpu::loadAttr<uint8_t, 4>(float*, const uint8_t*);
+template void Gpu::loadAttr<int16_t, 4>(float*, const uint8_t*);
+template void Gpu::loadAttr<float, 4>(float*, const uint8_t*);
 
 FORCE_INLINE uint32_t Gpu::flt24e7to32e8(uint32_t value) {
     // Convert a 24-bit float with 7-bit exponent to 32-bit with 8-bit exponent
@@ -78,38 +95,52 @@ void Gpu::runCommands() {
     }
 
     // Execute GPU commands until the end is reached
+    cmdPtrEnd = 0;
     while (cmdAddr < cmdEnd) {
+        // Resolve a host pointer to the rest of the list if the current one doesn't cover the next command
+        if (cmdAddr < cmdPtrAddr || cmdAddr + 8 > cmdPtrEnd) resolveCmds();
+        const uint32_t *words = cmdPtrEnd ? &cmdPtr[(cmdAddr - cmdPtrAddr) >> 2] : nullptr;
+
         // Decode the command header
-        uint32_t header = core->memory.read<uint32_t>(ARM11, cmdAddr + 4);
+        uint32_t header = words ? words[1] : core->memory.read<uint32_t>(ARM11, cmdAddr + 4);
         uint32_t mask = maskTable[(header >> 16) & 0xF];
         uint8_t count = (header >> 20) & 0xFF;
         curCmd = (header & 0x3FF);
 
+        // Fall back to reading the command into a buffer if it's not fully covered by the host pointer
+        uint32_t buffer[0x101];
+        if (!words || cmdAddr + ((count + 2) << 2) > cmdPtrEnd) {
+            for (int i = 0; i < count + 2; i++)
+                buffer[i] = core->memory.read<uint32_t>(ARM11, cmdAddr + (i << 2));
+            words = buffer;
+        }
+
         // Adjust the address for the next command with 64-bit alignment
-        uint32_t address = (cmdAddr + 4);
         cmdAddr += ((count + 3) << 2) & ~0x7;
 
         // Forward parameters to the thread if running, except for IRQ and jump commands
         if (thread && (curCmd & 0x3F0) != 0x10 && (curCmd < 0x238 || curCmd > 0x23D)) {
-            uint32_t *data = new uint32_t[count + 2];
-            data[0] = header;
-            data[1] = core->memory.read<uint32_t>(ARM11, address - 4);
-            for (int i = 0; i < count; i++)
-                data[i + 2] = core->memory.read<uint32_t>(ARM11, address += 4);
-            mutex.lock();
-            tasks.emplace(TASK_CMD, data);
-            mutex.unlock();
+            ringReserve(count + 3);
+            ring[ringPos++ & 0xFFFF] = TASK_CMD;
+            ring[ringPos++ & 0xFFFF] = header;
+            ring[ringPos++ & 0xFFFF] = words[0];
+            ringWrite(&words[2], count);
+            ringSubmit();
             continue;
         }
 
         // Write command parameters to GPU registers, with optionally increasing ID
-        (this->*cmdWrites[curCmd])(mask, core->memory.read<uint32_t>(ARM11, address - 4));
+        if (!thread) statCounts[STAT_CMDS] += count + 1;
+        writeCmd(curCmd, mask, words[0]);
         if (header & BIT(31)) // Increasing
             for (int i = 0; i < count; i++)
-                (this->*cmdWrites[++curCmd & 0x3FF])(mask, core->memory.read<uint32_t>(ARM11, address += 4));
+                writeCmd(++curCmd & 0x3FF, mask, words[i + 2]);
+        else if (!cmdSkip[curCmd] && !trace) // Fixed port
+            for (int i = 0; i < count; i++)
+                (this->*cmdWrites[curCmd])(mask, words[i + 2]);
         else // Fixed
             for (int i = 0; i < count; i++)
-                (this->*cmdWrites[curCmd])(mask, core->memory.read<uint32_t>(ARM11, address += 4));
+                writeCmd(curCmd, mask, words[i + 2]);
     }
 
     // Reset the command address to indicate being stopped
@@ -117,7 +148,44 @@ void Gpu::runCommands() {
     cmdAddr = -1;
 }
 
-void Gpu::drawAttrIdx(uint32_t idx) {
+void Gpu::writeCmd(uint16_t cmd, uint32_t mask, uint32_t value) {
+    // Skip writes that don't change a known state register value
+    if (cmdSkip[cmd] && !(mask & ~cmdKnown[cmd]) && !((cmdRegs[cmd] ^ value) & mask)) {
+        statCounts[STAT_SKIPS]++;
+        return;
+    }
+
+    // Write to a register and track its new value if it only holds state
+    if (cmdSkip[cmd]) {
+        cmdRegs[cmd] = (cmdRegs[cmd] & ~mask) | (value & mask);
+        cmdKnown[cmd] |= mask;
+    }
+    (this->*cmdWrites[cmd])(mask, value);
+
+    // Record the write if capturing a trace, except for IRQ and jump commands that only affect the CPU side
+    if (trace && (cmd & 0x3F0) != 0x10 && (cmd < 0x238 || cmd > 0x23D))
+        trace->writeCmd(cmd, mask, value);
+}
+
+void Gpu::resolveCmds() {
+    // Get a host pointer to the rest of the command list, or just the current page if not contiguous
+    cmdPtrAddr = cmdAddr;
+    cmdPtrEnd = cmdEnd;
+    if ((cmdPtr = (uint32_t*)core->memory.getHostPtr(cmdAddr, cmdEnd - cmdAddr, false))) return;
+    cmdPtrEnd = (cmdAddr + 0x1000) & ~0xFFF;
+    if (!(cmdPtr = (uint32_t*)core->memory.getHostPtr(cmdAddr, cmdPtrEnd - cmdAddr, false)))
+        cmdPtrEnd = 0;
+}
+
+template <typename T, int n> void Gpu::loadAttr(float *dst, const uint8_t *src) {
+    // Convert a packed attribute of any format to floats in a way that can vectorize
+    T data[n];
+    memcpy(data, src, sizeof(data));
+    for (int k = 0; k < n; k++)
+        dst[k] = data[k];
+}
+
+void Gpu::updateAttrs() {
     // Update the base shader input list using fixed attributes if dirty
     if (fixedDirty) {
         memset(fixedBase, 0, sizeof(fixedBase));
@@ -130,62 +198,158 @@ void Gpu::drawAttrIdx(uint32_t idx) {
             fixedBase[id][3] = *(float*)&(f = flt24e7to32e8(attrFixedData[i][0] >> 8));
         }
         fixedDirty = false;
+        attrDirty = true;
     }
 
-    // Build an input list on top of the base by parsing attribute arrays at the given index
-    float input[16][4];
-    memcpy(input, fixedBase, sizeof(input));
+    // Compile the attribute layout into load steps if any registers changed
+    if (!attrDirty) return;
+    memcpy(attrBase, fixedBase, sizeof(attrBase));
+    uint8_t steps = 0;
+    attrCount = 0;
+
     for (int i = 0; i < 12; i++) {
+        // Set up an array that can be located by index
+        AttrArray &array = attrArrays[attrCount];
         uint8_t count = std::min<uint8_t>(12, gpuAttrCfg[i] >> 60);
-        uint32_t base = (gpuAttrBase << 3) + gpuAttrOfs[i] + uint8_t(gpuAttrCfg[i] >> 48) * idx;
-        for (int j = 0; j < count; j++) {
-            // Skip over components that are just padding
-            uint8_t comp = (gpuAttrCfg[i] >> (j << 2)) & 0xF;
-            if (comp > 0xB) {
-                base = ((base + 2) & ~0x3) + ((comp - 0xB) << 2);
-                continue;
-            }
+        array.start = (gpuAttrBase << 3) + gpuAttrOfs[i];
+        array.stride = gpuAttrCfg[i] >> 48;
+        array.step = steps;
 
+        for (int j = 0; j < count; j++) {
             // Fill in default values that aren't provided by the array
+            uint8_t comp = (gpuAttrCfg[i] >> (j << 2)) & 0xF;
             uint8_t fmt = (gpuAttrFmt >> (comp << 2)) & 0xF;
             uint8_t id = (gpuVshAttrIds >> (comp << 2)) & 0xF;
+            if (comp > 0xB) continue;
             for (int k = 3; k > (fmt >> 2); k--)
-                input[id][k] = (k == 3) ? 1.0f : 0.0f;
-
-            // Handle components based on format and write them to their mapped input ID
-            switch (fmt & 0x3) {
-            case 0: // Signed byte
-                for (int k = 0; k <= (fmt >> 2); k++)
-                    input[id][k] = int8_t(core->memory.read<uint8_t>(ARM11, base++));
-                continue;
-
-            case 1: // Unsigned byte
-                for (int k = 0; k <= (fmt >> 2); k++)
-                    input[id][k] = core->memory.read<uint8_t>(ARM11, base++);
-                continue;
-
-            case 2: // Signed half-word
-                base = (base + 1) & ~0x1;
-                for (int k = 0; k <= (fmt >> 2); k++) {
-                    input[id][k] = int16_t(core->memory.read<uint16_t>(ARM11, base));
-                    base += 2;
-                }
-                continue;
-
-            case 3: // Single float
-                base = (base + 2) & ~0x3;
-                for (int k = 0; k <= (fmt >> 2); k++) {
-                    uint32_t value = core->memory.read<uint32_t>(ARM11, base);
-                    input[id][k] = *(float*)&value;
-                    base += 4;
+                attrBase[id][k] = (k == 3) ? 1.0f : 0.0f;
+            attrSteps[steps].load = attrLoads[fmt];
+            attrSteps[steps++].id = id;
+        }
+
+        // Drop arrays that only contain padding
+        if ((array.count = steps - array.step) == 0) continue;
+        attrCount++;
+
+        // Resolve component offsets for each possible element alignment, relative to the aligned start
+        for (int a = 0; a < 4; a++) {
+            uint8_t base = a, s = array.step;
+            for (int j = 0; j < count; j++) {
+                // Skip over components that are just padding
+                uint8_t comp = (gpuAttrCfg[i] >> (j << 2)) & 0xF;
+                if (comp > 0xB) {
+                    base = ((base + 2) & ~0x3) + ((comp - 0xB) << 2);
+                    continue;
                 }
-                continue;
+
+                // Align the component based on its format and advance past it
+                uint8_t fmt = (gpuAttrFmt >> (comp << 2)) & 0xF;
+                static const uint8_t sizes[] = { 1, 1, 2, 4 };
+                if ((fmt & 0x3) == 2) base = (base + 1) & ~0x1;
+                else if ((fmt & 0x3) == 3) base = (base + 2) & ~0x3;
+                attrSteps[s++].ofs[a] = base;
+                base += sizes[fmt & 0x3] * ((fmt >> 2) + 1);
             }
+            array.size[a] = base;
         }
     }
+    attrDirty = false;
+}
+
+void Gpu::resolveAttrs(uint32_t minIdx, uint32_t maxIdx) {
+    // Compile the attribute layout and look up host pointers covering the index range of each array
+    updateAttrs();
+    for (int i = 0; i < attrCount; i++) {
+        AttrArray &array = attrArrays[i];
+        uint32_t end = array.start + array.stride * maxIdx;
+        array.ptrBase = (array.start + array.stride * minIdx) & ~0x3;
+        end = (end & ~0x3) + std::max(std::max(array.size[0], array.size[1]), std::max(array.size[2], array.size[3]));
+        array.ptr = core->memory.getHostPtr(array.ptrBase, end - array.ptrBase, false);
+        if (trace) trace->writeMemory(array.ptrBase, end - array.ptrBase, false);
+    }
+}
 
-    // Pass the finished input to the shader
-    gpuShader->processVtx(input, idx);
+void Gpu::loadAttrs(float (*input)[4], uint32_t idx) {
+    // Build an input list on top of the base by running the load steps of each array at the given index
+    memcpy(input, attrBase, 16 * 4 * sizeof(float));
+    for (int i = 0; i < attrCount; i++) {
+        // Locate the element, falling back to slow reads if there's no host pointer
+        AttrArray &array = attrArrays[i];
+        uint32_t address = array.start + array.stride * idx;
+        uint8_t align = address & 0x3, data[0x100];
+        const uint8_t *src = data;
+        if (array.ptr)
+            src = array.ptr + ((address & ~0x3) - array.ptrBase);
+        else
+            for (int j = 0; j < array.size[align]; j++)
+                data[j] = core->memory.read<uint8_t>(ARM11, (address & ~0x3) + j);
+
+        // Convert each component and write it to its mapped input ID
+        AttrStep *step = &attrSteps[array.step];
+        for (int j = 0; j < array.count; j++, step++)
+            step->load(input[step->id], src + step->ofs[align]);
+    }
+}
+
+void Gpu::drawAttrRange(GpuShaderInterp *shader, uint32_t start, uint32_t end) {
+    // Load and queue a range of vertices in the current batch to be shaded, then flush them
+    float input[16][4];
+    for (uint32_t i = start; i < end; i++) {
+        uint32_t idx = vtxIndexed ? vtxIdxs[i] : (vtxFirst + i);
+        loadAttrs(input, idx);
+        shader->queueVtx(input, idx);
+    }
+    shader->flushVtxs();
+}
+
+void Gpu::drawAttrs() {
+    // Start or stop the vertex threads if their setting changed
+    if (Settings::threadedVerts != (vtxWorkers > 0))
+        Settings::threadedVerts ? startVtxThreads() : stopVtxThreads();
+
+    // Split large batches into chunks for the vertex threads, unless a geometry shader needs them in sequence
+    // or an attribute array has to be read slowly through memory handlers
+    uint32_t total = gpuAttrNumVerts;
+    uint8_t chunks = std::min<uint32_t>(vtxWorkers + 1, total / VTX_CHUNK_MIN);
+    for (int i = 0; i < attrCount; i++)
+        if (!attrArrays[i].ptr) chunks = 0;
+    if (chunks < 2 || (gpuGshConfig & BIT(1)))
+        return drawAttrRange(gpuShader, 0, total);
+
+    // Bring the worker shaders up to date and wake the threads to shade every chunk after the first,
+    // publishing the split under the lock so threads without a chunk never see it change
+    for (int i = 0; i < chunks - 1; i++) {
+        vtxShaders[i]->syncVsh(*gpuShader);
+        vtxShaders[i]->startList(vtxIndexed);
+        vtxShaders[i]->vtxBuffer.clear();
+    }
+    vtxPending.store(chunks - 1);
+    vtxMutex.lock();
+    vtxTotal = total;
+    vtxChunks = chunks;
+    vtxJob++;
+    vtxCond.notify_all();
+    vtxMutex.unlock();
+
+    // Shade the first chunk on this thread, submitting it directly while the others are in progress
+    drawAttrRange(gpuShader, 0, total / chunks);
+    {
+        std::unique_lock<std::mutex> lock(vtxMutex);
+        vtxDone.wait(lock, [&] { return !vtxPending.load(); });
+    }
+
+    // Submit the other chunks in order and collect their shader counters
+    for (int i = 0; i < chunks - 1; i++) {
+        GpuShaderInterp *shader = vtxShaders[i];
+        for (size_t j = 0; j < shader->vtxBuffer.size(); j++)
+            gpuRender->submitVertex(shader->vtxBuffer[j]);
+        gpuShader->vtxHits += shader->vtxHits;
+        gpuShader->vtxMisses += shader->vtxMisses;
+        gpuShader->instrCount += shader->instrCount;
+        gpuShader->shadeTime += shader->shadeTime;
+        shader->vtxHits = shader->vtxMisses = 0;
+        shader->instrCount = shader->shadeTime = 0;
+    }
 }
 
 void Gpu::updateShdMaps() {
@@ -581,19 +745,21 @@ void Gpu::writeColbufLoc(uint32_t mask, uint32_t value) {
 void Gpu::writeBufferDim(uint32_t mask, uint32_t value) {
     // Write to the render buffer dimensions and send them to the renderer
     mask &= 0x13FF7FF;
-    gpuColbufLoc = (gpuColbufLoc & ~mask) | (value & mask);
-    gpuRender->setBufferDims(gpuColbufLoc & 0x7FF, ((gpuColbufLoc >> 12) & 0x3FF) + 1, gpuColbufLoc & BIT(24));
+    gpuBufferDim = (gpuBufferDim & ~mask) | (value & mask);
+    gpuRender->setBufferDims(gpuBufferDim & 0x7FF, ((gpuBufferDim >> 12) & 0x3FF) + 1, gpuBufferDim & BIT(24));
 }
 
 void Gpu::writeAttrBase(uint32_t mask, uint32_t value) {
     // Write to the attribute buffer base address
     mask &= 0x1FFFFFFE;
     gpuAttrBase = (gpuAttrBase & ~mask) | (value & mask);
+    attrDirty = true;
 }
 
 void Gpu::writeAttrFmtL(uint32_t mask, uint32_t value) {
     // Write to the lower attribute buffer format register
     gpuAttrFmt = (gpuAttrFmt & ~mask) | (value & mask);
+    attrDirty = true;
 }
 
 void Gpu::writeAttrFmtH(uint32_t mask, uint32_t value) {
@@ -606,16 +772,19 @@ template <int i> void Gpu::writeAttrOfs(uint32_t mask, uint32_t value) {
     // Write to one of the attribute buffer address offsets
     mask &= 0xFFFFFFF;
     gpuAttrOfs[i] = (gpuAttrOfs[i] & ~mask) | (value & mask);
+    attrDirty = true;
 }
 
 template <int i> void Gpu::writeAttrCfgL(uint32_t mask, uint32_t value) {
     // Write to one of the lower attribute buffer config registers
     gpuAttrCfg[i] = (gpuAttrCfg[i] & ~mask) | (value & mask);
+    attrDirty = true;
 }
 
 template <int i> void Gpu::writeAttrCfgH(uint32_t mask, uint32_t value) {
     // Write to one of the upper attribute buffer config registers
     gpuAttrCfg[i] = (gpuAttrCfg[i] & ~(uint64_t(mask) << 32)) | (uint64_t(value & mask) << 32);
+    attrDirty = true;
 }
 
 void Gpu::writeAttrIdxList(uint32_t mask, uint32_t value) {
@@ -646,28 +815,59 @@ void Gpu::writeAttrFirstIdx(uint32_t mask, uint32_t value) {
 void Gpu::writeAttrDrawArrays(uint32_t mask, uint32_t value) {
     // Update shader state before a new vertex batch
     if (shdMapDirty) updateShdMaps();
-    gpuShader->startList();
+    gpuShader->startList(false);
 
     // Draw vertices from the attribute buffer using increasing indices
     LOG_INFO("GPU sending %d linear vertices to be rendered\n", gpuAttrNumVerts);
-    for (uint32_t i = 0; i < gpuAttrNumVerts; i++)
-        drawAttrIdx(gpuAttrFirstIdx + i);
+    if (!gpuAttrNumVerts) return;
+    if (trace) traceTextures();
+    uint64_t time = statClock();
+    resolveAttrs(gpuAttrFirstIdx, gpuAttrFirstIdx + gpuAttrNumVerts - 1);
+    vtxIndexed = false;
+    vtxFirst = gpuAttrFirstIdx;
+    drawAttrs();
+
+    // Count the vertices submitted and the time taken
+    statCounts[STAT_VERTS] += gpuAttrNumVerts;
+    if (time) statCounts[STAT_DRAW_TIME] += statClock() - time;
 }
 
 void Gpu::writeAttrDrawElems(uint32_t mask, uint32_t value) {
     // Update shader state before a new vertex batch
     if (shdMapDirty) updateShdMaps();
-    gpuShader->startList();
+    gpuShader->startList(true);
 
     // Draw vertices from the attribute buffer using indices from a list
     LOG_INFO("GPU sending %d indexed vertices to be rendered\n", gpuAttrNumVerts);
     uint32_t base = (gpuAttrBase << 3) + (gpuAttrIdxList & 0xFFFFFFF);
-    if (gpuAttrIdxList & BIT(31)) // 16-bit
-        for (uint32_t i = 0; i < gpuAttrNumVerts; i++)
-            drawAttrIdx(core->memory.read<uint16_t>(ARM11, base + (i << 1)));
-    else // 8-bit
-        for (uint32_t i = 0; i < gpuAttrNumVerts; i++)
-            drawAttrIdx(core->memory.read<uint8_t>(ARM11, base + i));
+    if (!gpuAttrNumVerts) return;
+
+    // Record the index list and textures if capturing a trace
+    if (trace) {
+        trace->writeMemory(base, gpuAttrNumVerts << (gpuAttrIdxList >> 31), false);
+        traceTextures();
+    }
+
+    // Read the index list and find its range so attribute arrays can be resolved once
+    uint64_t time = statClock();
+    uint32_t minIdx = -1, maxIdx = 0;
+    vtxIdxs.resize(gpuAttrNumVerts);
+    for (uint32_t i = 0; i < gpuAttrNumVerts; i++) {
+        uint32_t idx = (gpuAttrIdxList & BIT(31)) ? core->memory.read<uint16_t>(ARM11, base + (i << 1))
+            : core->memory.read<uint8_t>(ARM11, base + i);
+        minIdx = std::min(minIdx, idx);
+        maxIdx = std::max(maxIdx, idx);
+        vtxIdxs[i] = idx;
+    }
+
+    // Draw the indexed vertices
+    resolveAttrs(minIdx, maxIdx);
+    vtxIndexed = true;
+    drawAttrs();
+
+    // Count the vertices submitted and the time taken
+    statCounts[STAT_VERTS] += gpuAttrNumVerts;
+    if (time) statCounts[STAT_DRAW_TIME] += statClock() - time;
 }
 
 void Gpu::writeAttrFixedIdx(uint32_t mask, uint32_t value) {
@@ -704,7 +904,11 @@ void Gpu::writeAttrFixedData(uint32_t mask, uint32_t value) {
 
     // Pass the finished input to the shader
     if (shdMapDirty) updateShdMaps();
+    if (trace) traceTextures();
+    uint64_t time = statClock();
     gpuShader->processVtx(input);
+    statCounts[STAT_VERTS]++;
+    if (time) statCounts[STAT_DRAW_TIME] += statClock() - time;
 }
 
 template <int i> void Gpu::writeCmdSize(uint32_t mask, uint32_t value) {
@@ -885,6 +1089,7 @@ void Gpu::writeVshAttrIdsL(uint32_t mask, uint32_t value) {
 void Gpu::writeVshAttrIdsH(uint32_t mask, uint32_t value) {
     // Write to the upper vertex shader attribute IDs
     gpuVshAttrIds = (gpuVshAttrIds & ~(uint64_t(mask) << 32)) | (uint64_t(value & mask) << 32);
+    attrDirty = true;
 }
 
 void Gpu::writeVshOutMask(uint32_t mask, uint32_t value) {
@@ -941,6 +1146,6 @@ void Gpu::writeVshDescData(uint32_t mask, uint32_t value) {
 
 void Gpu::writeUnkCmd(uint32_t mask, uint32_t value) {
     // Catch unknown GPU commands, pulling ID from the thread if running
-    uint16_t cmd = (tasks.empty() ? curCmd : *(uint32_t*)tasks.front().data) & 0x3FF;
-    LOG_WARN("Unknown GPU command ID: 0x%X\n", cmd);
+    LOG_WARN("Unknown GPU command ID: 0x%X\n", ((thread && std::this_thread::get_id() == thread->get_id())
+        ? thrCmd : curCmd) & 0x3FF);
 }
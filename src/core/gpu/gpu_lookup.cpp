@@ -284,3 +284,28 @@ uint32_t Gpu::maskTable[] {
     0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF, 0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
     0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF, 0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF
 };
+
+// Ranges of GPU commands with side effects, which are never skipped for writing unchanged values
+const uint16_t Gpu::volatileCmds[][2] {
+    { 0x010, 0x01F }, // IRQ requests
+    { 0x107, 0x107 }, // Depth/color mask (shares the depth mask with 0x115)
+    { 0x113, 0x113 }, // Color buffer write (shares the color mask with 0x107)
+    { 0x115, 0x11E }, // Framebuffer setup (reloads buffers in some renderers)
+    { 0x229, 0x229 }, // Geometry shader config (shares the input count with 0x24A)
+    { 0x22E, 0x22F }, // Draw triggers
+    { 0x232, 0x235 }, // Fixed attribute ports
+    { 0x238, 0x23D }, // Command list jumps
+    { 0x24A, 0x24A }, // Vertex shader output total (shares the input count with 0x229)
+    { 0x25F, 0x25F }, // Primitive restart (strobe that applies the mode from 0x25E)
+    { 0x290, 0x2AF }, // Geometry uniform/code/descriptor ports
+    { 0x2C0, 0x2DF }, // Vertex uniform/code/descriptor ports
+    { 0x000, 0x000 }
+};
+
+// Lookup table for vertex attribute loaders, indexed by format
+void (*Gpu::attrLoads[])(float*, const uint8_t*) {
+    &Gpu::loadAttr<int8_t, 1>, &Gpu::loadAttr<uint8_t, 1>, &Gpu::loadAttr<int16_t, 1>, &Gpu::loadAttr<float, 1>,
+    &Gpu::loadAttr<int8_t, 2>, &Gpu::loadAttr<uint8_t, 2>, &Gpu::loadAttr<int16_t, 2>, &Gpu::loadAttr<float, 2>,
+    &Gpu::loadAttr<int8_t, 3>, &Gpu::loadAttr<uint8_t, 3>, &Gpu::loadAttr<int16_t, 3>, &Gpu::loadAttr<float, 3>,
+    &Gpu::loadAttr<int8_t, 4>, &Gpu::loadAttr<uint8_t, 4>, &Gpu::loadAttr<int16_t, 4>, &Gpu::loadAttr<float, 4>
+};
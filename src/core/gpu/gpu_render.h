@@ -29,7 +29,10 @@ public:
     virtual ~GpuRender() {}
 
     virtual void submitVertex(SoftVertex &vertex) = 0;
+    virtual void submitVertices(SoftVertex *vertices, uint32_t count) = 0;
     virtual void flushBuffers() = 0;
+    virtual void setFrameSkip(bool skip) = 0;
+    virtual void addDisplaySrc(uint32_t address) = 0;
 
     virtual void setPrimMode(PrimMode mode) = 0;
     virtual void setCullMode(CullMode mode) = 0;
@@ -69,6 +72,12 @@ public:
     virtual void setDepbufMask(uint8_t mask) = 0;
     virtual void setDepthFunc(TestFunc func) = 0;
 
+    static uint64_t hashData(const uint8_t *data, uint32_t size);
+
 protected:
     static const int16_t etc1Tables[8][4];
+    static const uint8_t swizzleX[8];
+    static const uint8_t swizzleY[8];
+
+    template <bool alpha> static void decodeEtc1(const uint8_t *src, uint32_t *dst);
 };
@@ -18,17 +18,21 @@
 */
 
 #include <algorithm>
+#include <cstring>
 
 #include "../core.h"
 #include "gpu_render_ogl.h"
 
+// Bits per texel for each texture format, used to size cached data
+const uint8_t GpuRenderOgl::texBits[] = { 32, 24, 16, 16, 16, 16, 16, 8, 8, 8, 4, 4, 4, 8, 0 };
+
 const char *GpuRenderOgl::vtxCode = R"(
     #version 330
 
-    in vec4 inPosition;
-    in vec4 inColor;
-    in vec3 inCoordsS;
-    in vec3 inCoordsT;
+    layout(location = 0) in vec4 inPosition;
+    layout(location = 1) in vec4 inColor;
+    layout(location = 2) in vec3 inCoordsS;
+    layout(location = 3) in vec3 inCoordsT;
 
     out vec4 vtxColor;
     out vec3 vtxCoordsS;
@@ -149,23 +153,63 @@ const char *GpuRenderOgl::fragCode = R"(
     }
 )";
 
+const char *GpuRenderOgl::fragHeader = R"(
+    #version 330
+
+    in vec4 vtxColor;
+    in vec3 vtxCoordsS;
+    in vec3 vtxCoordsT;
+    out vec4 fragColor;
+
+    uniform sampler2D texUnits[3];
+    uniform vec4 combColors[6];
+    uniform vec4 combBufColor;
+    uniform float alphaValue;
+
+    float dot3(vec3 c0, vec3 c1) {
+        return 4.0 * c0.r - 0.5 * c1.r - 0.5 + c0.g - 0.5 * c1.g - 0.5 + c0.b - 0.5 * c1.b - 0.5;
+    }
+)";
+
 GpuRenderOgl::GpuRenderOgl(Core *core): core(core) {
-    // Compile the vertex and fragment shaders
-    GLint vtxShader = glCreateShader(GL_VERTEX_SHADER);
+    // Compile the vertex shader, which is shared by every program
+    vtxShader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vtxShader, 1, &vtxCode, nullptr);
     glCompileShader(vtxShader);
     GLint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragShader, 1, &fragCode, nullptr);
     glCompileShader(fragShader);
 
-    // Create a program with the shaders
-    program = glCreateProgram();
-    glAttachShader(program, vtxShader);
-    glAttachShader(program, fragShader);
-    glLinkProgram(program);
-    glUseProgram(program);
-    glDeleteShader(vtxShader);
+    // Create the uber program, which handles any configuration while specialized ones compile
+    uber.program = glCreateProgram();
+    glAttachShader(uber.program, vtxShader);
+    glAttachShader(uber.program, fragShader);
+    glLinkProgram(uber.program);
     glDeleteShader(fragShader);
+    setupProgram(uber);
+    glUseProgram(curProgram = uber.program);
+
+    // Get uniform locations for configuration that only the uber program uses
+    combSrcsLoc = glGetUniformLocation(uber.program, "combSrcs");
+    combOpersLoc = glGetUniformLocation(uber.program, "combOpers");
+    combModesLoc = glGetUniformLocation(uber.program, "combModes");
+    combBufMaskLoc = glGetUniformLocation(uber.program, "combBufMask");
+    alphaFuncLoc = glGetUniformLocation(uber.program, "alphaFunc");
+
+    // Check for extensions that allow compiling programs in the background and persistent buffers
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; i++) {
+        const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (!strcmp(name, "GL_KHR_parallel_shader_compile") || !strcmp(name, "GL_ARB_parallel_shader_compile"))
+            parallelCompile = true;
+        else if (!strcmp(name, "GL_ARB_buffer_storage"))
+            bufferStorage = true;
+    }
+
+    // Load cached program binaries from disk if the driver supports them
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+    if ((binaryCache = (count > 0))) loadBinaries();
 
     // Create vertex array and buffer objects
     glGenVertexArrays(1, &vao);
@@ -173,54 +217,26 @@ GpuRenderOgl::GpuRenderOgl(Core *core): core(core) {
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-    // Configure vertex input attributes
-    GLint loc = glGetAttribLocation(program, "inPosition");
-    glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(SoftVertex), (void*)offsetof(SoftVertex, x));
-    glEnableVertexAttribArray(loc);
-    loc = glGetAttribLocation(program, "inColor");
-    glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(SoftVertex), (void*)offsetof(SoftVertex, r));
-    glEnableVertexAttribArray(loc);
-    loc = glGetAttribLocation(program, "inCoordsS");
-    glVertexAttribPointer(loc, 3, GL_FLOAT, GL_FALSE, sizeof(SoftVertex), (void*)offsetof(SoftVertex, s0));
-    glEnableVertexAttribArray(loc);
-    loc = glGetAttribLocation(program, "inCoordsT");
-    glVertexAttribPointer(loc, 3, GL_FLOAT, GL_FALSE, sizeof(SoftVertex), (void*)offsetof(SoftVertex, t0));
-    glEnableVertexAttribArray(loc);
-
-    // Set single uniform locations and initial values
-    posScaleLoc = glGetUniformLocation(program, "posScale");
-    glUniform4f(posScaleLoc, 1.0f, 1.0f, -1.0f, 1.0f);
-    combBufColorLoc = glGetUniformLocation(program, "combBufColor");
-    glUniform4f(combBufColorLoc, 0.0f, 0.0f, 0.0f, 0.0f);
-    combBufMaskLoc = glGetUniformLocation(program, "combBufMask");
-    glUniform1i(combBufMaskLoc, 0);
-    alphaFuncLoc = glGetUniformLocation(program, "alphaFunc");
-    glUniform1i(alphaFuncLoc, 0);
-    alphaValueLoc = glGetUniformLocation(program, "alphaValue");
-    glUniform1f(alphaValueLoc, 0.0f);
-
-    // Set array uniform locations and initial values
-    for (int i = 0; i < 6; i++) {
-        std::string name = "combColors[" + std::to_string(i) + "]";
-        combColorLocs[i] = glGetUniformLocation(program, name.c_str());
-        glUniform4f(combColorLocs[i], 0.0f, 0.0f, 0.0f, 0.0f);
-        for (int j = 0; j < 6; j++) {
-            name = "combSrcs[" + std::to_string(i * 6 + j) + "]";
-            combSrcLocs[i][j] = glGetUniformLocation(program, name.c_str());
-            glUniform1i(combSrcLocs[i][j], 0);
-            name = "combOpers[" + std::to_string(i * 6 + j) + "]";
-            combOperLocs[i][j] = glGetUniformLocation(program, name.c_str());
-            glUniform1i(combOperLocs[i][j], 0);
-            if (j >= 2) continue;
-            name = "combModes[" + std::to_string(i * 2 + j) + "]";
-            combModeLocs[i][j] = glGetUniformLocation(program, name.c_str());
-            glUniform1i(combModeLocs[i][j], 0);
-        }
-        if (i >= 3) continue;
-        name = "texUnits[" + std::to_string(i) + "]";
-        glUniform1i(glGetUniformLocation(program, name.c_str()), i);
+    // Allocate a streaming vertex buffer, persistently mapped if supported
+    if (bufferStorage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, VBO_SIZE, nullptr, flags);
+        vboData = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, VBO_SIZE, flags);
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, VBO_SIZE, nullptr, GL_STREAM_DRAW);
     }
 
+    // Configure vertex input attributes at the locations fixed in the vertex shader
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(OglVertex), (void*)offsetof(OglVertex, x));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(OglVertex), (void*)offsetof(OglVertex, r));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(OglVertex), (void*)offsetof(OglVertex, s0));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(OglVertex), (void*)offsetof(OglVertex, t0));
+    glEnableVertexAttribArray(3);
+
     // Set some state that only has to be done once
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClearDepth(1.0f);
@@ -251,15 +267,22 @@ GpuRenderOgl::GpuRenderOgl(Core *core): core(core) {
 }
 
 GpuRenderOgl::~GpuRenderOgl() {
-    // Clean up everything that was generated
+    // Write any pending readbacks to memory and clean up everything that was generated
+    resolveReadbacks(0, 0xFFFFFFFF);
+    glDeleteBuffers(pboPool.size(), pboPool.data());
     for (int i = 0; i < texCache.size(); i++)
         glDeleteTextures(1, &texCache[i].tex);
     glDeleteTextures(1, &texture);
     glDeleteRenderbuffers(1, &depBuf);
     glDeleteFramebuffers(1, &colBuf);
+    for (int i = 0; i < VBO_SIZE / VBO_SEGMENT; i++)
+        if (vboFences[i]) glDeleteSync(vboFences[i]);
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(program);
+    for (uint32_t i = 0; i < shaderCache.size(); i++)
+        glDeleteProgram(shaderCache[i].prog.program);
+    glDeleteProgram(uber.program);
+    glDeleteShader(vtxShader);
 }
 
 uint32_t GpuRenderOgl::getSwizzle(int x, int y, int width) {
@@ -270,176 +293,627 @@ uint32_t GpuRenderOgl::getSwizzle(int x, int y, int width) {
     return ofs;
 }
 
-template <bool alpha> uint32_t GpuRenderOgl::etc1Texel(int i, int x, int y) {
-    // Convert coordinates to an offset and index
-    uint32_t ofs = getSwizzle(x, y, texWidths[i]), value;
-    uint8_t idx = (x & 0x3) * 4 + (y & 0x3);
-    int r, g, b, a;
+std::string GpuRenderOgl::getSrcCode(int i, int src, int oper) {
+    // Get code for a texture combiner source
+    std::string code;
+    switch (src) {
+        case 0: code = "vtxColor"; break;
+        case 1: case 2: code = "vec4(0.5, 0.5, 0.5, 1.0)"; break;
+        case 3: case 4: case 5: code = "tex" + std::to_string(src - 3); break;
+        case 6: code = "vec4(1.0, 1.0, 1.0, 1.0)"; break;
+        case 7: code = "combBuffer"; break;
+        case 8: code = "combColors[" + std::to_string(i) + "]"; break;
+        case 9: code = "prevColor"; break;
+        default: code = "vec4(0.0, 0.0, 0.0, 0.0)"; break;
+    }
 
-    // Adjust the offset for 4x4 ETC1 tiles and read alpha if provided
-    if (alpha) {
-        ofs = (ofs & ~0xF) + 8;
-        value = core->memory.read<uint8_t>(ARM11, texAddrs[i] + ofs - 8 + idx / 2);
-        a = ((value >> ((idx & 0x1) * 4)) & 0xF) * 0xFF / 0xF;
+    // Apply a texture combiner operand to the source code
+    switch (oper) {
+        default: return "(" + code + ")";
+        case 1: return "(1.0 - " + code + ")";
+        case 2: return "(" + code + ".aaaa)";
+        case 3: return "(1.0 - " + code + ".aaaa)";
+        case 4: return "(" + code + ".rrrr)";
+        case 5: return "(1.0 - " + code + ".rrrr)";
+        case 6: return "(" + code + ".gggg)";
+        case 7: return "(1.0 - " + code + ".gggg)";
+        case 8: return "(" + code + ".bbbb)";
+        case 9: return "(1.0 - " + code + ".bbbb)";
     }
-    else {
-        ofs = (ofs & ~0xF) >> 1;
-        a = 0xFF;
-    }
-
-    // Decode an ETC1 texel based on the block it falls in and the base color mode
-    int32_t val1 = core->memory.read<uint32_t>(ARM11, texAddrs[i] + ofs + 0);
-    int32_t val2 = core->memory.read<uint32_t>(ARM11, texAddrs[i] + ofs + 4);
-    if ((((val2 & BIT(0)) ? y : x) & 0x3) < 2) { // Block 1
-        int16_t tbl = etc1Tables[(val2 >> 5) & 0x7][((val1 >> (idx + 15)) & 0x2) | ((val1 >> idx) & 0x1)];
-        if (val2 & BIT(1)) { // Differential
-            r = ((val2 >> 27) & 0x1F) * 0x21 / 4 + tbl;
-            g = ((val2 >> 19) & 0x1F) * 0x21 / 4 + tbl;
-            b = ((val2 >> 11) & 0x1F) * 0x21 / 4 + tbl;
+}
+
+std::string GpuRenderOgl::getFragCode(const ShaderConfig &config) {
+    // Sample only the texture units that are used as combiner sources
+    std::string code = fragHeader;
+    code += "void main() {\nvec4 color, prevColor = vec4(0.0, 0.0, 0.0, 0.0), combBuffer = combBufColor;\n";
+    for (int t = 0; t < 3; t++) {
+        const uint8_t *end = &config.srcs[0][0] + 36;
+        if (std::find(&config.srcs[0][0], end, t + 3) == end) continue;
+        std::string n = std::to_string(t);
+        code += "vec4 tex" + n + " = texture(texUnits[" + n + "], vec2(vtxCoordsS[" + n + "], vtxCoordsT[" + n + "]));\n";
+    }
+
+    // Generate straight-line code for each texture combiner's RGB and alpha modes
+    for (int i = 0; i < 6; i++) {
+        std::string s[6];
+        for (int j = 0; j < 6; j++)
+            s[j] = getSrcCode(i, config.srcs[i][j], config.opers[i][j]) + ((j < 3) ? ".rgb" : ".a");
+        switch (config.modes[i][0]) {
+            case 0: code += "color.rgb = " + s[0] + ";\n"; break;
+            case 1: code += "color.rgb = " + s[0] + " * " + s[1] + ";\n"; break;
+            case 2: code += "color.rgb = " + s[0] + " + " + s[1] + ";\n"; break;
+            case 3: code += "color.rgb = " + s[0] + " + " + s[1] + " - 0.5;\n"; break;
+            case 4: code += "color.rgb = mix(" + s[1] + ", " + s[0] + ", " + s[2] + ");\n"; break;
+            case 5: code += "color.rgb = " + s[0] + " - " + s[1] + ";\n"; break;
+            case 6: case 7: code += "color.rgb = vec3(dot3(" + s[0] + ", " + s[1] + "));\n"; break;
+            case 8: code += "color.rgb = (" + s[0] + " * " + s[1] + ") + " + s[2] + ";\n"; break;
+            case 9: code += "color.rgb = (" + s[0] + " + " + s[1] + ") * " + s[2] + ";\n"; break;
+            default: code += "color.rgb = vec3(0.0, 0.0, 0.0);\n"; break;
         }
-        else { // Individual
-            r = ((val2 >> 28) & 0xF) * 0x11 + tbl;
-            g = ((val2 >> 20) & 0xF) * 0x11 + tbl;
-            b = ((val2 >> 12) & 0xF) * 0x11 + tbl;
+        switch (config.modes[i][1]) {
+            case 0: code += "color.a = " + s[3] + ";\n"; break;
+            case 1: code += "color.a = " + s[3] + " * " + s[4] + ";\n"; break;
+            case 2: code += "color.a = " + s[3] + " + " + s[4] + ";\n"; break;
+            case 3: code += "color.a = " + s[3] + " + " + s[4] + " - 0.5;\n"; break;
+            case 4: code += "color.a = mix(" + s[4] + ", " + s[3] + ", " + s[5] + ");\n"; break;
+            case 5: code += "color.a = " + s[3] + " - " + s[4] + ";\n"; break;
+            case 7: code += "color.a = dot3(vec3(" + s[3] + "), vec3(" + s[4] + "));\n"; break;
+            case 8: code += "color.a = (" + s[3] + " * " + s[4] + ") + " + s[5] + ";\n"; break;
+            case 9: code += "color.a = (" + s[3] + " + " + s[4] + ") * " + s[5] + ";\n"; break;
+            default: code += "color.a = 1.0;\n"; break;
         }
+
+        // Update the previous color and combiner buffer
+        code += "prevColor = color;\n";
+        if (i >= 4) continue;
+        if (config.bufMask & (0x01 << i)) code += "combBuffer.rgb = color.rgb;\n";
+        if (config.bufMask & (0x10 << i)) code += "combBuffer.a = color.a;\n";
+    }
+
+    // Generate code for the alpha test and finish
+    switch (config.alphaFunc) {
+        case 0: code += "discard;\n"; break;
+        case 2: code += "if (color.a != alphaValue) discard;\n"; break;
+        case 3: code += "if (color.a == alphaValue) discard;\n"; break;
+        case 4: code += "if (color.a >= alphaValue) discard;\n"; break;
+        case 5: code += "if (color.a > alphaValue) discard;\n"; break;
+        case 6: code += "if (color.a <= alphaValue) discard;\n"; break;
+        case 7: code += "if (color.a < alphaValue) discard;\n"; break;
+    }
+    return code + "fragColor = color;\n}\n";
+}
+
+void GpuRenderOgl::setupProgram(ShaderProg &prog) {
+    // Get uniform locations that every program shares
+    prog.posScaleLoc = glGetUniformLocation(prog.program, "posScale");
+    prog.combColorsLoc = glGetUniformLocation(prog.program, "combColors");
+    prog.combBufColorLoc = glGetUniformLocation(prog.program, "combBufColor");
+    prog.alphaValueLoc = glGetUniformLocation(prog.program, "alphaValue");
+    prog.version = 0;
+
+    // Assign texture units to the samplers, restoring the current program after
+    glUseProgram(prog.program);
+    for (int i = 0; i < 3; i++) {
+        std::string name = "texUnits[" + std::to_string(i) + "]";
+        glUniform1i(glGetUniformLocation(prog.program, name.c_str()), i);
+    }
+    glUseProgram(curProgram);
+}
+
+void GpuRenderOgl::createProgram(ShaderCache &cache) {
+    // Try to load the program from a cached binary with a matching configuration
+    cache.prog.program = glCreateProgram();
+    ShaderBinary cmp; cmp.hash = cache.hash;
+    auto it = std::lower_bound(shaderBinaries.cbegin(), shaderBinaries.cend(), cmp);
+    for (; it != shaderBinaries.cend() && it->hash == cache.hash; it++) {
+        if (memcmp(&it->config, &cache.config, sizeof(ShaderConfig))) continue;
+        glProgramBinary(cache.prog.program, it->format, &it->data[0], it->data.size());
+        GLint status = GL_FALSE;
+        glGetProgramiv(cache.prog.program, GL_LINK_STATUS, &status);
+        if (!status) break;
+        setupProgram(cache.prog);
+        cache.ready = true;
+        return;
+    }
+
+    // Compile the program from generated code otherwise, which may finish in the background
+    std::string code = getFragCode(cache.config);
+    const char *data = code.c_str();
+    GLint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragShader, 1, &data, nullptr);
+    glCompileShader(fragShader);
+    glAttachShader(cache.prog.program, vtxShader);
+    glAttachShader(cache.prog.program, fragShader);
+    if (binaryCache) glProgramParameteri(cache.prog.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(cache.prog.program);
+    glDeleteShader(fragShader);
+}
+
+void GpuRenderOgl::pollProgram(ShaderCache &cache) {
+    // Check if a program is done compiling, waiting for it if it can't be checked in the background
+    GLint status = GL_TRUE;
+    if (parallelCompile) glGetProgramiv(cache.prog.program, GL_COMPLETION_STATUS_ARB, &status);
+    if (!status) return;
+
+    // Fall back to the uber program for good if linking failed
+    glGetProgramiv(cache.prog.program, GL_LINK_STATUS, &status);
+    if (!status) {
+        LOG_WARN("Failed to compile a specialized GPU program\n");
+        cache.failed = true;
+        return;
     }
-    else { // Block 2
-        int16_t tbl = etc1Tables[(val2 >> 2) & 0x7][((val1 >> (idx + 15)) & 0x2) | ((val1 >> idx) & 0x1)];
-        if (val2 & BIT(1)) { // Differential
-            r = (((val2 >> 27) & 0x1F) + (int8_t(val2 >> 19) >> 5)) * 0x21 / 4 + tbl;
-            g = (((val2 >> 19) & 0x1F) + (int8_t(val2 >> 11) >> 5)) * 0x21 / 4 + tbl;
-            b = (((val2 >> 11) & 0x1F) + (int8_t(val2 >> 3) >> 5)) * 0x21 / 4 + tbl;
+
+    // Finish setting up the program and save it to disk
+    setupProgram(cache.prog);
+    cache.ready = true;
+    saveBinary(cache);
+}
+
+void GpuRenderOgl::updateProgram() {
+    // Look up a specialized program for the current configuration, creating one if it's new
+    ShaderCache cmp = {};
+    cmp.hash = hashData((uint8_t*)&config, sizeof(ShaderConfig));
+    auto it = std::lower_bound(shaderCache.begin(), shaderCache.end(), cmp);
+    while (it != shaderCache.end() && it->hash == cmp.hash && memcmp(&it->config, &config, sizeof(ShaderConfig)))
+        it++;
+    if (it == shaderCache.end() || it->hash != cmp.hash) {
+        cmp.config = config;
+        createProgram(cmp);
+        it = shaderCache.insert(it, cmp);
+    }
+
+    // Use the specialized program if it's ready, or keep checking on it and use the uber program
+    if (!it->ready && !it->failed) pollProgram(*it);
+    ShaderProg &prog = it->ready ? it->prog : uber;
+    progDirty = !it->ready && !it->failed;
+    if (prog.program != curProgram)
+        glUseProgram(curProgram = prog.program);
+
+    // Update configuration uniforms if the uber program is used and they changed
+    if (&prog == &uber && memcmp(&uberConfig, &config, sizeof(ShaderConfig))) {
+        GLint srcs[6 * 6], opers[6 * 6], modes[6 * 2];
+        for (int i = 0; i < 6 * 6; i++) {
+            srcs[i] = config.srcs[i / 6][i % 6];
+            opers[i] = config.opers[i / 6][i % 6];
+            if (i < 6 * 2) modes[i] = config.modes[i / 2][i % 2];
         }
-        else { // Individual
-            r = ((val2 >> 24) & 0xF) * 0x11 + tbl;
-            g = ((val2 >> 16) & 0xF) * 0x11 + tbl;
-            b = ((val2 >> 8) & 0xF) * 0x11 + tbl;
+        glUniform1iv(combSrcsLoc, 6 * 6, srcs);
+        glUniform1iv(combOpersLoc, 6 * 6, opers);
+        glUniform1iv(combModesLoc, 6 * 2, modes);
+        glUniform1i(combBufMaskLoc, config.bufMask);
+        glUniform1i(alphaFuncLoc, config.alphaFunc);
+        uberConfig = config;
+    }
+
+    // Update value uniforms if they changed since the program was last used
+    if (prog.version == uniformVersion) return;
+    glUniform4fv(prog.posScaleLoc, 1, posScale);
+    glUniform4fv(prog.combColorsLoc, 6, combColors[0]);
+    glUniform4fv(prog.combBufColorLoc, 1, combBufColor);
+    glUniform1f(prog.alphaValueLoc, alphaValue);
+    prog.version = uniformVersion;
+}
+
+void GpuRenderOgl::loadBinaries() {
+    // Identify the driver, since program binaries are only valid for the one that made them
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        if (const char *str = (const char*)glGetString(name)) binaryId += std::string(str) + ";";
+
+    // Check that the cache file exists and was made by the same driver
+    FILE *file = fopen((Settings::basePath + "/shaders.bin").c_str(), "rb");
+    if (!file) return;
+    uint32_t size = 0;
+    std::string id;
+    if (fread(&size, sizeof(size), 1, file) == 1 && size == binaryId.size()) {
+        id.resize(size);
+        if (size && fread(&id[0], 1, size, file) != size) id = "";
+    }
+
+    // Load every complete binary in the file, ordered by configuration hash
+    binaryValid = (id == binaryId);
+    if (binaryValid) {
+        ShaderBinary bin;
+        while (fread(&bin.hash, sizeof(bin.hash), 1, file) == 1 && fread(&bin.config, sizeof(ShaderConfig), 1, file) == 1
+            && fread(&bin.format, sizeof(bin.format), 1, file) == 1 && fread(&size, sizeof(size), 1, file) == 1) {
+            bin.data.resize(size);
+            if (!size || fread(&bin.data[0], 1, size, file) != size) break;
+            shaderBinaries.insert(std::upper_bound(shaderBinaries.begin(), shaderBinaries.end(), bin), bin);
         }
     }
+    fclose(file);
+}
 
-    // Clamp and return the final color values
-    r = std::min(0xFF, std::max(0, r));
-    g = std::min(0xFF, std::max(0, g));
-    b = std::min(0xFF, std::max(0, b));
-    return (r << 24) | (g << 16) | (b << 8) | a;
+void GpuRenderOgl::saveBinary(ShaderCache &cache) {
+    // Get a program's binary if supported
+    if (!binaryCache) return;
+    GLint size = 0;
+    glGetProgramiv(cache.prog.program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+    std::vector<uint8_t> data(size);
+    GLenum format;
+    glGetProgramBinary(cache.prog.program, size, &size, &format, &data[0]);
+
+    // Append the binary to the cache file, starting a new one if it was missing or for another driver
+    FILE *file = fopen((Settings::basePath + "/shaders.bin").c_str(), binaryValid ? "ab" : "wb");
+    if (!file) return;
+    if (!binaryValid) {
+        uint32_t len = binaryId.size();
+        fwrite(&len, sizeof(len), 1, file);
+        fwrite(binaryId.c_str(), 1, len, file);
+        binaryValid = true;
+    }
+    uint32_t len = size;
+    fwrite(&cache.hash, sizeof(cache.hash), 1, file);
+    fwrite(&cache.config, sizeof(ShaderConfig), 1, file);
+    fwrite(&format, sizeof(format), 1, file);
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite(&data[0], 1, len, file);
+    fclose(file);
+}
+
+uint16_t GpuRenderOgl::toHalf(float value) {
+    // Convert a float to a half float, rounding to nearest
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exp = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t man = bits & 0x7FFFFF;
+
+    // Handle infinity and NaN, overflow, and values that are denormal or zero as half floats
+    if (((bits >> 23) & 0xFF) == 0xFF) return sign | 0x7C00 | (man ? 0x200 : 0);
+    if (exp >= 0x1F) return sign | 0x7C00;
+    if (exp <= 0) {
+        if (exp < -10) return sign;
+        man |= 0x800000;
+        uint32_t shift = 14 - exp;
+        return sign | ((man >> shift) + ((man >> (shift - 1)) & 0x1));
+    }
+    return (sign | (exp << 10) | (man >> 13)) + ((man >> 12) & 0x1);
+}
+
+OglVertex GpuRenderOgl::toOglVertex(const SoftVertex &vertex) {
+    // Convert a vertex to the compact format, with half float colors
+    OglVertex v = { vertex.x, vertex.y, vertex.z, vertex.w, toHalf(vertex.r), toHalf(vertex.g),
+        toHalf(vertex.b), toHalf(vertex.a), vertex.s0, vertex.s1, vertex.s2, vertex.t0, vertex.t1, vertex.t2 };
+    return v;
 }
 
 void GpuRenderOgl::submitVertex(SoftVertex &vertex) {
-    // Queue a vertex to be drawn
-    vertices.push_back(vertex);
+    // Convert the vertex for drawing
+    OglVertex v = toOglVertex(vertex);
+
+    // Assemble separate triangles based on the current primitive mode, so draws can be batched across modes
+    switch (primMode) {
+    case TRIANGLES:
+    case GEO_PRIM:
+        // Queue separate triangles every 3 vertices
+        asmVtx[vtxCount] = v;
+        if (++vtxCount < 3) return;
+        vtxCount = 0;
+        return queueTriangle(asmVtx[0], asmVtx[1], asmVtx[2]);
+
+    case TRI_STRIPS:
+        // Queue triangles in strips that reuse the last 2 vertices
+        switch (vtxCount++) {
+        case 0: case 1:
+            asmVtx[vtxCount - 1] = v;
+            return;
+        case 2: // v0, v1, v2
+            asmVtx[2] = v;
+            return queueTriangle(asmVtx[0], asmVtx[1], asmVtx[2]);
+        case 3: // v2, v1, v3
+            asmVtx[0] = v;
+            return queueTriangle(asmVtx[2], asmVtx[1], asmVtx[0]);
+        case 4: // v2, v3, v4
+            asmVtx[1] = v;
+            return queueTriangle(asmVtx[2], asmVtx[0], asmVtx[1]);
+        case 5: // v4, v3, v5
+            asmVtx[2] = v;
+            return queueTriangle(asmVtx[1], asmVtx[0], asmVtx[2]);
+        case 6: // v4, v5, v6
+            asmVtx[0] = v;
+            return queueTriangle(asmVtx[1], asmVtx[2], asmVtx[0]);
+        default: // v6, v5, v7
+            asmVtx[1] = v;
+            vtxCount = 2;
+            return queueTriangle(asmVtx[0], asmVtx[2], asmVtx[1]);
+        }
+
+    case TRI_FANS:
+        // Queue triangles in a fan that reuses the first vertex
+        switch (vtxCount++) {
+        case 0: case 1:
+            asmVtx[vtxCount - 1] = v;
+            return;
+        case 2: // v0, v1, v2
+            asmVtx[2] = v;
+            return queueTriangle(asmVtx[0], asmVtx[1], asmVtx[2]);
+        default: // v0, v2, v3
+            asmVtx[1] = v;
+            vtxCount = 2;
+            return queueTriangle(asmVtx[0], asmVtx[2], asmVtx[1]);
+        }
+    }
+}
+
+void GpuRenderOgl::submitVertices(SoftVertex *list, uint32_t count) {
+    // Queue whole triangles straight from the list when separate triangles start fresh
+    uint32_t i = 0;
+    if ((primMode == TRIANGLES || primMode == GEO_PRIM) && !vtxCount) {
+        uint32_t end = count - count % 3;
+        for (; i < end; i++) {
+            asmVtx[i % 3] = toOglVertex(list[i]);
+            if (i % 3 == 2) queueTriangle(asmVtx[0], asmVtx[1], asmVtx[2]);
+        }
+    }
+
+    // Submit any remaining vertices one at a time
+    for (; i < count; i++)
+        submitVertex(list[i]);
+}
+
+void GpuRenderOgl::queueTriangle(OglVertex &v0, OglVertex &v1, OglVertex &v2) {
+    // Queue a triangle to be drawn and count it
+    core->gpu.statCounts[STAT_TRIS]++;
+    vertices.push_back(v0);
+    vertices.push_back(v1);
+    vertices.push_back(v2);
+}
+
+uint32_t GpuRenderOgl::streamVertices(const OglVertex *data, uint32_t count) {
+    // Start the data at the first whole vertex in the next segment if it would cross into it, so a persistent
+    // segment is only fenced once every draw reading from it has been issued
+    uint32_t size = count * sizeof(OglVertex);
+    if (vboData && vboPos / VBO_SEGMENT != (vboPos + size - 1) / VBO_SEGMENT) {
+        vboPos = (vboPos / VBO_SEGMENT + 1) * VBO_SEGMENT + sizeof(OglVertex) - 1;
+        vboPos -= vboPos % sizeof(OglVertex);
+    }
+
+    // Wrap to the start of the streaming buffer if the data won't fit, orphaning it if not persistent
+    if (vboPos + size > VBO_SIZE) {
+        vboPos = 0;
+        if (vboData)
+            do nextSegment(); while (vboSeg != 0);
+        else
+            glBufferData(GL_ARRAY_BUFFER, VBO_SIZE, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Copy data to a persistent mapping once the GPU is done with the segment it starts
+    if (vboData) {
+        if (vboSeg != int(vboPos / VBO_SEGMENT)) nextSegment();
+        memcpy(&vboData[vboPos], data, size);
+    }
+    else {
+        // Map the range without synchronizing otherwise, since it hasn't been used since orphaning
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        memcpy(glMapBufferRange(GL_ARRAY_BUFFER, vboPos, size, flags), data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    // Advance the position and return the index of the first vertex
+    uint32_t first = vboPos / sizeof(OglVertex);
+    vboPos += size;
+    return first;
+}
+
+void GpuRenderOgl::nextSegment() {
+    // Fence the current segment of the streaming buffer and wait for the GPU to finish with the next one
+    vboFences[vboSeg] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    vboSeg = (vboSeg + 1) % (VBO_SIZE / VBO_SEGMENT);
+    if (!vboFences[vboSeg]) return;
+    while (glClientWaitSync(vboFences[vboSeg], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(vboFences[vboSeg]);
+    vboFences[vboSeg] = nullptr;
 }
 
 void GpuRenderOgl::flushVertices() {
-    // Update state and draw queued vertices
+    // Update state for drawing queued vertices
     if (vertices.empty()) return;
     if (readDirty) updateBuffers();
     if (texDirty) updateTextures();
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SoftVertex), &vertices[0], GL_DYNAMIC_DRAW);
-    glDrawArrays(primMode, 0, vertices.size());
-    vertices = {};
+    if (progDirty) updateProgram();
+
+    // Stream the vertices and draw them as one batch, splitting it if it's too big for the buffer
+    const uint32_t limit = VBO_SEGMENT / sizeof(OglVertex) / 3 * 3;
+    for (uint32_t i = 0; i < vertices.size(); i += limit) {
+        uint32_t count = std::min<uint32_t>(vertices.size() - i, limit);
+        glDrawArrays(GL_TRIANGLES, streamVertices(&vertices[i], count), count);
+    }
+    vertices.clear();
     writeDirty = true;
 }
 
 void GpuRenderOgl::flushBuffers() {
-    // Check if anything has been drawn and make sure it's done
+    // Read back anything drawn and resolve every pending readback, since memory is about to be used
+    queueReadback();
+    resolveReadbacks(0, 0xFFFFFFFF);
+
+    // Revalidate textures on the next draw, since memory can change after this
+    texEpoch++;
+    texDirty = BIT(3) - 1;
+}
+
+uint32_t GpuRenderOgl::getBufSize(ColbufFmt format, uint16_t width, uint16_t height) {
+    // Get the size of a color buffer in memory based on format
+    switch (format) {
+        case COL_RGBA8: return width * height * 4;
+        case COL_RGB8: return width * height * 3;
+        case COL_UNK: return 0;
+        default: return width * height * 2;
+    }
+}
+
+void GpuRenderOgl::queueReadback() {
+    // Check if anything has been drawn to a known format
     flushVertices();
     if (!writeDirty) return;
-    glFinish();
+    writeDirty = false;
+    if (colbufFmt == COL_UNK) return;
 
-    // Copy data from the color buffer to memory based on format
-    uint32_t *data;
-    uint16_t w = bufWidth, h = bufHeight;
+    // Reuse a free pixel buffer or create a new one
+    Readback rb = { colbufAddr, uint16_t(bufWidth), uint16_t(bufHeight), colbufFmt };
+    if (pboPool.empty()) {
+        glGenBuffers(1, &rb.pbo);
+    }
+    else {
+        rb.pbo = pboPool.back();
+        pboPool.pop_back();
+    }
+
+    // Start an asynchronous copy from the color buffer to the pixel buffer based on format
+    uint32_t size = bufWidth * bufHeight * ((colbufFmt <= COL_RGB8) ? 4 : 2);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
     switch (colbufFmt) {
-    case COL_RGBA8:
-        data = new uint32_t[w * h];
-        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x++)
-                core->memory.write<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 4, data[y * w + x]);
-        break;
-    case COL_RGB8:
-        data = new uint32_t[w * h];
-        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                uint32_t src = data[y * w + x], dst = colbufAddr + getSwizzle(x, y, w) * 3;
-                core->memory.write<uint8_t>(ARM11, dst + 0, src >> 8);
-                core->memory.write<uint8_t>(ARM11, dst + 1, src >> 16);
-                core->memory.write<uint8_t>(ARM11, dst + 2, src >> 24);
-            }
-        }
+    case COL_RGBA8: case COL_RGB8:
+        glReadPixels(0, 0, bufWidth, bufHeight, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
         break;
     case COL_RGB565:
-        data = new uint32_t[w * h / 2];
-        glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                core->memory.write<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2, data[(y * w + x) / 2]);
+        glReadPixels(0, 0, bufWidth, bufHeight, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, nullptr);
         break;
     case COL_RGB5A1:
-        data = new uint32_t[w * h / 2];
-        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, data);
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                core->memory.write<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2, data[(y * w + x) / 2]);
+        glReadPixels(0, 0, bufWidth, bufHeight, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, nullptr);
         break;
     case COL_RGBA4:
-        data = new uint32_t[w * h / 2];
-        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, data);
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                core->memory.write<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2, data[(y * w + x) / 2]);
+        glReadPixels(0, 0, bufWidth, bufHeight, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, nullptr);
         break;
     }
 
-    // Clean up and finish
-    delete[] data;
-    writeDirty = false;
+    // Fence the copy so it can be waited on once the data is needed
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbacks.push_back(rb);
+
+    // Revalidate textures on the next draw, since one could be sampling the color buffer
+    texEpoch++;
+    texDirty = BIT(3) - 1;
+}
+
+void GpuRenderOgl::resolveReadbacks(uint32_t start, uint32_t end) {
+    // Find the last pending readback that overlaps the range, if any
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < readbacks.size(); i++) {
+        Readback &rb = readbacks[i];
+        if (rb.addr < end && rb.addr + getBufSize(rb.fmt, rb.width, rb.height) > start)
+            count = i + 1;
+    }
+
+    // Write pending readbacks to memory in order, up to and including the overlapping one
+    for (uint32_t i = 0; i < count; i++) {
+        Readback &rb = readbacks[i];
+        uint16_t w = rb.width, h = rb.height;
+        uint32_t size = getBufSize(rb.fmt, w, h);
+        while (glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(rb.fence);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+        const uint32_t *data = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER,
+            0, w * h * ((rb.fmt <= COL_RGB8) ? 4 : 2), GL_MAP_READ_BIT);
+
+        // Drop the readback if the pixel buffer can't be mapped
+        if (!data) {
+            LOG_WARN("Failed to map a GPU readback buffer\n");
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            pboPool.push_back(rb.pbo);
+            continue;
+        }
+
+        // Convert data directly into memory if possible, or stage it otherwise
+        uint8_t *dst = core->memory.getHostPtr(rb.addr, size, true);
+        bool staged = !dst;
+        if (staged) stage.resize(size), dst = &stage[0];
+        switch (rb.fmt) {
+        case COL_RGBA8:
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    U8TO32(dst, getSwizzle(x, y, w) * 4) = data[y * w + x];
+            break;
+        case COL_RGB8:
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    uint32_t src = data[y * w + x];
+                    uint8_t *p = &dst[getSwizzle(x, y, w) * 3];
+                    p[0] = src >> 8, p[1] = src >> 16, p[2] = src >> 24;
+                }
+            }
+            break;
+        default:
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x += 2)
+                    U8TO32(dst, getSwizzle(x, y, w) * 2) = data[(y * w + x) / 2];
+            break;
+        }
+
+        // Write back staged data and remember what the color buffer holds if it's still current
+        if (staged)
+            for (uint32_t j = 0; j < size; j++)
+                core->memory.write<uint8_t>(ARM11, rb.addr + j, stage[j]);
+        if (rb.addr == heldAddr && w == heldWidth && h == heldHeight && rb.fmt == heldFmt)
+            heldHash = hashData(dst, size);
+
+        // Release the pixel buffer for reuse
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        pboPool.push_back(rb.pbo);
+    }
+    readbacks.erase(readbacks.begin(), readbacks.begin() + count);
 }
 
 void GpuRenderOgl::updateBuffers() {
-    // Copy data from memory to the color buffer based on format
-    uint32_t *data;
+    // Make sure memory is current and check if it still matches what the color buffer holds
     uint16_t w = bufWidth, h = bufHeight;
-    glActiveTexture(GL_TEXTURE4);
-    switch (colbufFmt) {
-    case COL_RGBA8:
-        data = new uint32_t[w * h];
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x++)
-                data[y * w + x] = core->memory.read<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 4);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bufWidth, bufHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
-        break;
-    case COL_RGB8:
-        data = new uint32_t[w * h];
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x++)
-                data[y * w + x] = core->memory.read<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 3 - 1) | 0xFF;
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bufWidth, bufHeight, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
-        break;
-    case COL_RGB565:
-        data = new uint32_t[w * h / 2];
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                data[(y * w + x) / 2] = core->memory.read<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bufWidth, bufHeight, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
-        break;
-    case COL_RGB5A1:
-        data = new uint32_t[w * h / 2];
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                data[(y * w + x) / 2] = core->memory.read<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bufWidth, bufHeight, 0, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, data);
-        break;
-    case COL_RGBA4:
-        data = new uint32_t[w * h / 2];
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x += 2)
-                data[(y * w + x) / 2] = core->memory.read<uint32_t>(ARM11, colbufAddr + getSwizzle(x, y, w) * 2);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bufWidth, bufHeight, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, data);
-        break;
+    uint32_t size = getBufSize(colbufFmt, w, h);
+    resolveReadbacks(colbufAddr, colbufAddr + size);
+    const uint8_t *src = size ? getReadPtr(colbufAddr, size) : nullptr;
+    uint64_t hash = src ? hashData(src, size) : 0;
+    bool held = (colbufAddr == heldAddr && w == heldWidth && h == heldHeight && colbufFmt == heldFmt);
+
+    // Copy data from memory to the color buffer based on format, unless it was unchanged
+    if (src && !(held && hash == heldHash)) {
+        uint32_t *data = new uint32_t[w * h];
+        glActiveTexture(GL_TEXTURE4);
+        switch (colbufFmt) {
+        case COL_RGBA8:
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    data[y * w + x] = U8TO32(src, getSwizzle(x, y, w) * 4);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
+            break;
+        case COL_RGB8:
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    const uint8_t *p = &src[getSwizzle(x, y, w) * 3];
+                    data[y * w + x] = (p[2] << 24) | (p[1] << 16) | (p[0] << 8) | 0xFF;
+                }
+            }
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
+            break;
+        default:
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x += 2)
+                    data[(y * w + x) / 2] = U8TO32(src, getSwizzle(x, y, w) * 2);
+            switch (colbufFmt) {
+            case COL_RGB565:
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+                break;
+            case COL_RGB5A1:
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, data);
+                break;
+            default:
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, data);
+                break;
+            }
+            break;
+        }
+        delete[] data;
     }
 
+    // Remember what the color buffer holds so unchanged memory can skip the upload next time
+    heldAddr = colbufAddr;
+    heldWidth = w;
+    heldHeight = h;
+    heldFmt = colbufFmt;
+    heldHash = hash;
+
     // Resize and clear the depth/stencil buffer, restoring state after
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, bufWidth, bufHeight);
     glDepthMask(GL_TRUE);
@@ -449,52 +923,107 @@ void GpuRenderOgl::updateBuffers() {
     glDepthMask(depbufMask);
     glStencilMask(stencilMasks[0]);
     updateViewport();
-
-    // Clean up and finish
-    delete[] data;
     readDirty = false;
 }
 
+const uint8_t *GpuRenderOgl::getReadPtr(uint32_t address, uint32_t size) {
+    // Get data directly from memory, staging it if it isn't contiguous
+    if (const uint8_t *src = core->memory.getHostPtr(address, size, false))
+        return src;
+    stage.resize(size);
+    for (uint32_t j = 0; j < size; j++)
+        stage[j] = core->memory.read<uint8_t>(ARM11, address + j);
+    return &stage[0];
+}
+
+void GpuRenderOgl::evictTextures(uint32_t size) {
+    // Delete least recently used textures until a new one fits in the memory budget
+    while (texMemory + size > TEX_BUDGET) {
+        auto lru = texCache.end();
+        for (auto it = texCache.begin(); it != texCache.end(); it++) {
+            if (it->tex == texBound[0] || it->tex == texBound[1] || it->tex == texBound[2]) continue;
+            if (lru == texCache.end() || it->lastUse < lru->lastUse) lru = it;
+        }
+
+        // Stop if everything left is bound and can't be evicted
+        if (lru == texCache.end()) return;
+        glDeleteTextures(1, &lru->tex);
+        texMemory -= lru->memory;
+        texCache.erase(lru);
+    }
+}
+
 void GpuRenderOgl::updateTextures() {
     // Update any textures that are dirty
     for (int i = 0; texDirty >> i; i++) {
         if (~texDirty & BIT(i)) continue;
         glActiveTexture(GL_TEXTURE0 + i);
 
-        // Check for a matching texture in the cache
-        // TODO: invalidate modified textures
-        const TexCache *cache = nullptr;
-        TexCache cmp; cmp.addr = texAddrs[i];
-        auto it = std::lower_bound(texCache.cbegin(), texCache.cend(), cmp);
-        while (it < texCache.cend() && it->addr == texAddrs[i]) {
-            if (it->width == texWidths[i] && it->height == texHeights[i] && it->fmt == texFmts[i]) {
-                cache = &*it;
-                break;
-            }
-            it++;
-        }
-
-        // Create a new cached texture or bind an existing one
-        if (!cache) {
-            TexCache tex = { texAddrs[i], texWidths[i], texHeights[i], texFmts[i] };
-            glGenTextures(1, &tex.tex);
-            glBindTexture(GL_TEXTURE_2D, tex.tex);
-            it = std::upper_bound(texCache.cbegin(), texCache.cend(), tex);
-            texCache.insert(it, tex);
-        }
-        else {
-            glBindTexture(GL_TEXTURE_2D, cache->tex);
+        // Check for a cached texture matching address, format, and dimensions
+        TexCache cmp = { texAddrs[i], texWidths[i], texHeights[i], texFmts[i] };
+        auto it = std::lower_bound(texCache.begin(), texCache.end(), cmp);
+        bool cached = (it != texCache.end() && !(cmp < *it));
+
+        // Leave textures without data if they don't cover whole 8x8 tiles, so they get uploaded blank
+        uint16_t w = texWidths[i], h = texHeights[i];
+        bool tiled = (w && h && !(w & 0x7) && !(h & 0x7));
+        uint32_t stripe = tiled ? (w * texBits[std::min<int>(texFmts[i], TEX_UNK)]) : 0;
+
+        // Create a new cached texture, making room for it in the budget if necessary
+        if (!cached) {
+            cmp.memory = std::max(w * h * 4, 4);
+            evictTextures(cmp.memory);
+            glGenTextures(1, &cmp.tex);
+            cmp.hashes.resize(stripe ? (h >> 3) : 0);
+            it = texCache.insert(std::lower_bound(texCache.begin(), texCache.end(), cmp), cmp);
+            texMemory += cmp.memory;
         }
 
-        // Update texture parameters and finish if already cached
+        // Bind the texture and update its parameters
+        glBindTexture(GL_TEXTURE_2D, texBound[i] = it->tex);
+        it->lastUse = ++texUses;
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texWrapS[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texWrapT[i]);
         glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, texBorders[i]);
-        if (cache) continue;
 
-        // Set texture swizzling based on format
+        // Finish if a cached texture has already been validated since memory could have changed
+        if (cached) core->gpu.statCounts[STAT_TEX_HITS]++;
+        if (cached && it->epoch == texEpoch) continue;
+        it->epoch = texEpoch;
+        uint32_t size = stripe * it->hashes.size();
+        resolveReadbacks(texAddrs[i], texAddrs[i] + size);
+        const uint8_t *src = size ? getReadPtr(texAddrs[i], size) : nullptr;
+
+        // Hash each row of tiles, and upload ranges of rows that changed since the last upload
+        int rows = it->hashes.size();
+        if (cached) {
+            for (int y = 0, y0 = -1; y <= rows; y++) {
+                uint64_t hash = (y < rows) ? hashData(&src[y * stripe], stripe) : 0;
+                if (y < rows && it->hashes[y] != hash) {
+                    it->hashes[y] = hash;
+                    if (y0 < 0) y0 = y;
+                }
+                else if (y0 >= 0) {
+                    uploadTexture(i, src, y0 << 3, y << 3, true);
+                    y0 = -1;
+                }
+            }
+            continue;
+        }
+
+        // Hash each row of tiles of a new texture and upload it in full
+        for (int y = 0; y < rows; y++)
+            it->hashes[y] = hashData(&src[y * stripe], stripe);
+        uploadTexture(i, src, 0, h, false);
+    }
+    texDirty = 0;
+}
+
+void GpuRenderOgl::uploadTexture(int i, const uint8_t *src, int y0, int y1, bool update) {
+    // Set texture swizzling based on format for new uploads
+    if (!update) {
         switch (texFmts[i]) {
         case TEX_RG8:
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_GREEN);
@@ -526,112 +1055,91 @@ void GpuRenderOgl::updateTextures() {
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ALPHA);
             break;
         }
+    }
 
-        // Decode and upload a texture based on format
-        uint16_t w = texWidths[i], h = texHeights[i], y1 = (h - 1);
-        uint32_t *dat32; uint16_t *dat16;
+    // Decode a range of texture rows based on format, flipping them vertically
+    uint16_t w = texWidths[i], h = texHeights[i];
+    core->gpu.statCounts[STAT_TEXELS] += w * (y1 - y0);
+    texBuf.resize(std::max(w * (y1 - y0), 1));
+    uint32_t *dat32 = &texBuf[0], tile[64], etc;
+    uint16_t *dat16 = (uint16_t*)dat32;
+    GLint inFmt; GLenum fmt, type;
+    switch (src ? texFmts[i] : TEX_UNK) {
+    case TEX_RGBA8:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--)
+            for (int x = 0; x < w; x++)
+                dat32[r * w + x] = U8TO32(src, getSwizzle(x, y, w) * 4);
+        inFmt = GL_RGBA, fmt = GL_RGBA, type = GL_UNSIGNED_INT_8_8_8_8;
+        break;
+    case TEX_RGB8:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--) {
+            for (int x = 0; x < w; x++) {
+                const uint8_t *texel = &src[getSwizzle(x, y, w) * 3];
+                dat32[r * w + x] = (texel[2] << 24) | (texel[1] << 16) | (texel[0] << 8);
+            }
+        }
+        inFmt = GL_RGB, fmt = GL_RGBA, type = GL_UNSIGNED_INT_8_8_8_8;
+        break;
+    case TEX_RGB5A1: case TEX_RGB565: case TEX_RGBA4: case TEX_LA8: case TEX_RG8:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--)
+            for (int x = 0; x < w; x += 2)
+                dat32[(r * w + x) / 2] = U8TO32(src, getSwizzle(x, y, w) * 2);
         switch (texFmts[i]) {
-        case TEX_RGBA8:
-            dat32 = new uint32_t[w * h];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x++)
-                    dat32[y1 * w + x] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 4);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_RGB8:
-            dat32 = new uint32_t[w * h];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x++)
-                    dat32[y1 * w + x] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 3 - 1);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_RGB5A1:
-            dat32 = new uint32_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x += 2)
-                    dat32[(y1 * w + x) / 2] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 2);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_RGB565:
-            dat32 = new uint32_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x += 2)
-                    dat32[(y1 * w + x) / 2] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 2);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_RGBA4:
-            dat32 = new uint32_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x += 2)
-                    dat32[(y1 * w + x) / 2] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 2);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_LA8: case TEX_RG8:
-            dat32 = new uint32_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x += 2)
-                    dat32[(y1 * w + x) / 2] = core->memory.read<uint32_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) * 2);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, w, h, 0, GL_RG, GL_UNSIGNED_BYTE, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_L8: case TEX_A8:
-            dat16 = new uint16_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x += 2)
-                    dat16[(y1 * w + x) / 2] = core->memory.read<uint16_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w));
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, dat16);
-            delete[] dat16;
-            continue;
-        case TEX_LA4:
-            dat16 = new uint16_t[w * h];
-            for (int y = 0; y < h; y++, y1--) {
-                for (int x = 0; x < w; x++) {
-                    uint8_t val = core->memory.read<uint8_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w));
-                    dat16[y1 * w + x] = (((val >> 4) * 0xFF / 0xF) << 8) | ((val & 0xF) * 0xFF / 0xF);
-                }
+            case TEX_RGB5A1: inFmt = GL_RGBA, fmt = GL_RGBA, type = GL_UNSIGNED_SHORT_5_5_5_1; break;
+            case TEX_RGB565: inFmt = GL_RGB, fmt = GL_RGB, type = GL_UNSIGNED_SHORT_5_6_5; break;
+            case TEX_RGBA4: inFmt = GL_RGBA, fmt = GL_RGBA, type = GL_UNSIGNED_SHORT_4_4_4_4; break;
+            default: inFmt = GL_RG, fmt = GL_RG, type = GL_UNSIGNED_BYTE; break;
+        }
+        break;
+    case TEX_L8: case TEX_A8:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--)
+            for (int x = 0; x < w; x += 2)
+                dat16[(r * w + x) / 2] = U8TO16(src, getSwizzle(x, y, w));
+        inFmt = GL_RED, fmt = GL_RED, type = GL_UNSIGNED_BYTE;
+        break;
+    case TEX_LA4:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--) {
+            for (int x = 0; x < w; x++) {
+                uint8_t val = src[getSwizzle(x, y, w)];
+                dat16[r * w + x] = (((val >> 4) * 0xFF / 0xF) << 8) | ((val & 0xF) * 0xFF / 0xF);
             }
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, w, h, 0, GL_RG, GL_UNSIGNED_BYTE, dat16);
-            delete[] dat16;
-            continue;
-        case TEX_L4: case TEX_A4:
-            dat16 = new uint16_t[w * h / 2];
-            for (int y = 0; y < h; y++, y1--) {
-                for (int x = 0; x < w; x += 2) {
-                    uint8_t val = core->memory.read<uint8_t>(ARM11, texAddrs[i] + getSwizzle(x, y, w) / 2);
-                    dat16[(y1 * w + x) / 2] = (((val >> 4) * 0xFF / 0xF) << 8) | ((val & 0xF) * 0xFF / 0xF);
-                }
+        }
+        inFmt = GL_RG, fmt = GL_RG, type = GL_UNSIGNED_BYTE;
+        break;
+    case TEX_L4: case TEX_A4:
+        for (int y = y0, r = y1 - y0 - 1; y < y1; y++, r--) {
+            for (int x = 0; x < w; x += 2) {
+                uint8_t val = src[getSwizzle(x, y, w) / 2];
+                dat16[(r * w + x) / 2] = (((val >> 4) * 0xFF / 0xF) << 8) | ((val & 0xF) * 0xFF / 0xF);
+            }
+        }
+        inFmt = GL_RED, fmt = GL_RED, type = GL_UNSIGNED_BYTE;
+        break;
+    case TEX_ETC1: case TEX_ETC1A4:
+        // Decode 8x8 tiles of ETC1 blocks at once
+        etc = (texFmts[i] == TEX_ETC1A4) ? 64 : 32;
+        src += y0 * w / 64 * etc;
+        for (int y = y0; y < y1; y += 8) {
+            for (int x = 0; x < w; x += 8, src += etc) {
+                (etc == 64) ? decodeEtc1<true>(src, tile) : decodeEtc1<false>(src, tile);
+                for (int ty = 0; ty < 8; ty++)
+                    memcpy(&dat32[(y1 - y - ty - 1) * w + x], &tile[ty * 8], 8 * sizeof(uint32_t));
             }
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, dat16);
-            delete[] dat16;
-            continue;
-        case TEX_ETC1:
-            dat32 = new uint32_t[w * h];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x++)
-                    dat32[y1 * w + x] = etc1Texel<false>(i, x, y);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, dat32);
-            delete[] dat32;
-            continue;
-        case TEX_ETC1A4:
-            dat32 = new uint32_t[w * h];
-            for (int y = 0; y < h; y++, y1--)
-                for (int x = 0; x < w; x++)
-                    dat32[y1 * w + x] = etc1Texel<true>(i, x, y);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, dat32);
-            delete[] dat32;
-            continue;
-        default:
-            w = 0xFFFF;
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, &w);
-            continue;
         }
+        inFmt = GL_RGBA, fmt = GL_RGBA, type = GL_UNSIGNED_INT_8_8_8_8;
+        break;
+    default:
+        // Upload a blank texture for unknown formats or missing data
+        dat32[0] = 0xFFFF;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, dat32);
+        return;
     }
-    texDirty = 0;
+
+    // Upload the rows, updating existing storage in place for partial updates
+    if (update)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, h - y1, w, y1 - y0, fmt, type, dat32);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, inFmt, w, h, 0, fmt, type, dat32);
 }
 
 void GpuRenderOgl::updateViewport() {
@@ -641,14 +1149,9 @@ void GpuRenderOgl::updateViewport() {
 }
 
 void GpuRenderOgl::setPrimMode(PrimMode mode) {
-    // Set a new primitive mode
-    flushVertices();
-    switch (mode) {
-        case TRIANGLES: primMode = GL_TRIANGLES; return;
-        case TRI_STRIPS: primMode = GL_TRIANGLE_STRIP; return;
-        case TRI_FANS: primMode = GL_TRIANGLE_FAN; return;
-        case GEO_PRIM: primMode = GL_TRIANGLES; return;
-    }
+    // Change primitive mode and reset the vertex count, without breaking the batch
+    primMode = mode;
+    vtxCount = 0;
 }
 
 void GpuRenderOgl::setCullMode(CullMode mode) {
@@ -663,14 +1166,16 @@ void GpuRenderOgl::setCullMode(CullMode mode) {
 }
 
 void GpuRenderOgl::setTexAddr(int i, uint32_t address) {
-    // Set a texture unit's address and mark it as dirty
+    // Set a texture unit's address and mark it as dirty if it changed
+    if (texAddrs[i] == address) return;
     flushVertices();
     texAddrs[i] = address;
     texDirty |= BIT(i);
 }
 
 void GpuRenderOgl::setTexDims(int i, uint16_t width, uint16_t height) {
-    // Set a texture unit's dimensions and mark it as dirty
+    // Set a texture unit's dimensions and mark them as dirty if they changed
+    if (texWidths[i] == width && texHeights[i] == height) return;
     flushVertices();
     texWidths[i] = width;
     texHeights[i] = height;
@@ -685,7 +1190,8 @@ void GpuRenderOgl::setTexBorder(int i, float r, float g, float b, float a) {
 }
 
 void GpuRenderOgl::setTexFmt(int i, TexFmt format) {
-    // Set a texture unit's format and mark it as dirty
+    // Set a texture unit's format and mark it as dirty if it changed
+    if (texFmts[i] == format) return;
     flushVertices();
     texFmts[i] = format;
     texDirty |= BIT(i);
@@ -716,39 +1222,55 @@ void GpuRenderOgl::setTexWrapT(int i, TexWrap wrap) {
 }
 
 void GpuRenderOgl::setCombSrc(int i, int j, CombSrc src) {
-    // Update one of the texture combiner source uniforms
+    // Update one of the texture combiner sources and mark the program as dirty if it changed
+    if (config.srcs[i][j] == src) return;
     flushVertices();
-    glUniform1i(combSrcLocs[i][j], src);
+    config.srcs[i][j] = src;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setCombOper(int i, int j, CombOper oper) {
-    // Update one of the texture combiner operand uniforms
+    // Update one of the texture combiner operands and mark the program as dirty if it changed
+    if (config.opers[i][j] == oper) return;
     flushVertices();
-    glUniform1i(combOperLocs[i][j], oper);
+    config.opers[i][j] = oper;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setCombMode(int i, int j, CalcMode mode) {
-    // Update one of the texture combiner mode uniforms
+    // Update one of the texture combiner modes and mark the program as dirty if it changed
+    if (config.modes[i][j] == mode) return;
     flushVertices();
-    glUniform1i(combModeLocs[i][j], mode);
+    config.modes[i][j] = mode;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setCombColor(int i, float r, float g, float b, float a) {
-    // Update one of the texture combiner color uniforms
+    // Update one of the texture combiner colors and mark uniforms as dirty if it changed
+    float color[4] = { r, g, b, a };
+    if (!memcmp(combColors[i], color, sizeof(color))) return;
     flushVertices();
-    glUniform4f(combColorLocs[i], r, g, b, a);
+    combColors[i][0] = r, combColors[i][1] = g, combColors[i][2] = b, combColors[i][3] = a;
+    uniformVersion++;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setCombBufColor(float r, float g, float b, float a) {
-    // Update the texture combiner buffer color uniform
+    // Update the texture combiner buffer color and mark uniforms as dirty if it changed
+    float color[4] = { r, g, b, a };
+    if (!memcmp(combBufColor, color, sizeof(color))) return;
     flushVertices();
-    glUniform4f(combBufColorLoc, r, g, b, a);
+    combBufColor[0] = r, combBufColor[1] = g, combBufColor[2] = b, combBufColor[3] = a;
+    uniformVersion++;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setCombBufMask(uint8_t mask) {
-    // Update the texture combiner buffer mask uniform
+    // Update the texture combiner buffer mask and mark the program as dirty if it changed
+    if (config.bufMask == mask) return;
     flushVertices();
-    glUniform1i(combBufMaskLoc, mask);
+    config.bufMask = mask;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setBlendOper(int i, BlendOper oper) {
@@ -793,15 +1315,20 @@ void GpuRenderOgl::setBlendColor(float r, float g, float b, float a) {
 }
 
 void GpuRenderOgl::setAlphaFunc(TestFunc func) {
-    // Update the alpha test function uniform
+    // Update the alpha test function and mark the program as dirty if it changed
+    if (config.alphaFunc == func) return;
     flushVertices();
-    glUniform1i(alphaFuncLoc, func);
+    config.alphaFunc = func;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setAlphaValue(float value) {
-    // Update the alpha test reference uniform
+    // Update the alpha test reference and mark uniforms as dirty if it changed
+    if (alphaValue == value) return;
     flushVertices();
-    glUniform1f(alphaValueLoc, value);
+    alphaValue = value;
+    uniformVersion++;
+    progDirty = true;
 }
 
 void GpuRenderOgl::setStencilTest(TestFunc func, bool enable) {
@@ -873,26 +1400,28 @@ void GpuRenderOgl::setViewScaleV(float scale) {
 
 void GpuRenderOgl::setBufferDims(uint16_t width, uint16_t height, bool flip) {
     // Set new buffer dimensions and mark them as dirty
-    flushBuffers();
+    queueReadback();
     bufWidth = width;
     bufHeight = height;
     readDirty = true;
 
     // Update the position scale to flip the Y-axis if enabled
-    glUniform4f(posScaleLoc, 1.0f, flip ? -1.0f : 1.0f, -1.0f, 1.0f);
+    posScale[1] = flip ? -1.0f : 1.0f;
+    uniformVersion++;
+    progDirty = true;
     flipY = flip;
 }
 
 void GpuRenderOgl::setColbufAddr(uint32_t address) {
     // Set a new color buffer address and mark it as dirty
-    flushBuffers();
+    queueReadback();
     colbufAddr = address;
     readDirty = true;
 }
 
 void GpuRenderOgl::setColbufFmt(ColbufFmt format) {
     // Set a new color buffer format and mark it as dirty
-    flushBuffers();
+    queueReadback();
     colbufFmt = format;
     readDirty = true;
 }
@@ -20,20 +20,89 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
 #include <epoxy/gl.h>
 
 #include "gpu_render.h"
 
 class Core;
 
+// Size of the streaming vertex buffer, and of the segments that are fenced separately
+#define VBO_SIZE (4 << 20)
+#define VBO_SEGMENT (VBO_SIZE / 4)
+
+// Host memory budget for cached textures before the least recently used are evicted
+#define TEX_BUDGET (256 << 20)
+
 struct TexCache {
     uint32_t addr;
     uint16_t width;
     uint16_t height;
     TexFmt fmt;
     GLuint tex;
+    uint32_t memory;
+    uint32_t epoch;
+    uint32_t lastUse;
+    std::vector<uint64_t> hashes;
+
+    bool operator<(const TexCache &t) const {
+        if (addr != t.addr) return addr < t.addr;
+        if (fmt != t.fmt) return fmt < t.fmt;
+        return (width != t.width) ? (width < t.width) : (height < t.height);
+    }
+};
+
+struct OglVertex {
+    float x, y, z, w;
+    uint16_t r, g, b, a;
+    float s0, s1, s2;
+    float t0, t1, t2;
+};
+
+struct ShaderConfig {
+    uint8_t srcs[6][6];
+    uint8_t opers[6][6];
+    uint8_t modes[6][2];
+    uint8_t bufMask;
+    uint8_t alphaFunc;
+};
+
+struct ShaderProg {
+    GLuint program;
+    GLint posScaleLoc;
+    GLint combColorsLoc;
+    GLint combBufColorLoc;
+    GLint alphaValueLoc;
+    uint32_t version;
+};
+
+struct ShaderCache {
+    uint64_t hash;
+    ShaderConfig config;
+    ShaderProg prog;
+    bool ready;
+    bool failed;
 
-    bool operator<(const TexCache &t) const { return addr < t.addr; }
+    bool operator<(const ShaderCache &s) const { return hash < s.hash; }
+};
+
+struct ShaderBinary {
+    uint64_t hash;
+    ShaderConfig config;
+    GLenum format;
+    std::vector<uint8_t> data;
+
+    bool operator<(const ShaderBinary &s) const { return hash < s.hash; }
+};
+
+struct Readback {
+    uint32_t addr;
+    uint16_t width;
+    uint16_t height;
+    ColbufFmt fmt;
+    GLuint pbo;
+    GLsync fence;
 };
 
 class GpuRenderOgl: public GpuRender {
@@ -42,7 +111,10 @@ public:
     ~GpuRenderOgl();
 
     void submitVertex(SoftVertex &vertex);
+    void submitVertices(SoftVertex *list, uint32_t count);
     void flushBuffers();
+    void setFrameSkip(bool skip) {}
+    void addDisplaySrc(uint32_t address) {}
 
     void setPrimMode(PrimMode mode);
     void setCullMode(CullMode mode);
@@ -84,28 +156,48 @@ public:
 
 private:
     Core *core;
-    GLuint program;
+    GLuint vtxShader;
     GLuint vao, vbo;
     GLuint colBuf, depBuf;
     GLuint texture;
 
-    GLint posScaleLoc;
-    GLint combSrcLocs[6][6];
-    GLint combOperLocs[6][6];
-    GLint combModeLocs[6][2];
-    GLint combColorLocs[6];
-    GLint combBufColorLoc;
+    ShaderProg uber = {};
+    GLint combSrcsLoc;
+    GLint combOpersLoc;
+    GLint combModesLoc;
     GLint combBufMaskLoc;
     GLint alphaFuncLoc;
-    GLint alphaValueLoc;
 
+    static const uint8_t texBits[];
     static const char *vtxCode;
     static const char *fragCode;
+    static const char *fragHeader;
 
-    std::vector<SoftVertex> vertices;
+    std::vector<OglVertex> vertices;
+    OglVertex asmVtx[3];
+    uint8_t *vboData = nullptr;
+    GLsync vboFences[VBO_SIZE / VBO_SEGMENT] = {};
+    uint32_t vboPos = 0;
+    int vboSeg = 0;
     std::vector<TexCache> texCache;
-    GLint primMode = GL_TRIANGLES;
+    std::vector<ShaderCache> shaderCache;
+    std::vector<ShaderBinary> shaderBinaries;
+    std::vector<Readback> readbacks;
+    std::vector<GLuint> pboPool;
+    std::vector<uint8_t> stage;
+    std::vector<uint32_t> texBuf;
+    uint64_t texMemory = 0;
+    uint32_t texEpoch = 0;
+    uint32_t texUses = 0;
+    GLuint texBound[3] = {};
+    PrimMode primMode = TRIANGLES;
+    uint8_t vtxCount = 0;
     uint8_t texDirty = 0;
+    bool progDirty = true;
+    bool parallelCompile = false;
+    bool bufferStorage = false;
+    bool binaryCache = false;
+    bool binaryValid = false;
     bool readDirty = false;
     bool writeDirty = false;
 
@@ -131,11 +223,45 @@ private:
     GLint stencilValue = 0;
     GLuint stencilMasks[2] = {};
 
+    ShaderConfig config = {};
+    ShaderConfig uberConfig = {};
+    GLuint curProgram = 0;
+    uint32_t uniformVersion = 1;
+    float posScale[4] = { 1.0f, 1.0f, -1.0f, 1.0f };
+    float combColors[6][4] = {};
+    float combBufColor[4] = {};
+    float alphaValue = 0.0f;
+    std::string binaryId;
+
+    uint32_t heldAddr = 0;
+    uint16_t heldWidth = 0;
+    uint16_t heldHeight = 0;
+    ColbufFmt heldFmt = COL_UNK;
+    uint64_t heldHash = 0;
+
     static uint32_t getSwizzle(int x, int y, int width);
-    template <bool alpha> uint32_t etc1Texel(int i, int x, int y);
+    static uint16_t toHalf(float value);
+    static OglVertex toOglVertex(const SoftVertex &vertex);
+    static std::string getSrcCode(int i, int src, int oper);
+    static std::string getFragCode(const ShaderConfig &config);
+    static uint32_t getBufSize(ColbufFmt format, uint16_t width, uint16_t height);
 
+    void queueTriangle(OglVertex &v0, OglVertex &v1, OglVertex &v2);
+    uint32_t streamVertices(const OglVertex *data, uint32_t count);
+    void nextSegment();
     void flushVertices();
+    void setupProgram(ShaderProg &prog);
+    void createProgram(ShaderCache &cache);
+    void pollProgram(ShaderCache &cache);
+    void updateProgram();
+    void loadBinaries();
+    void saveBinary(ShaderCache &cache);
+    void queueReadback();
+    void resolveReadbacks(uint32_t start, uint32_t end);
     void updateBuffers();
     void updateTextures();
+    void uploadTexture(int i, const uint8_t *src, int y0, int y1, bool update);
+    const uint8_t *getReadPtr(uint32_t address, uint32_t size);
+    void evictTextures(uint32_t size);
     void updateViewport();
 };
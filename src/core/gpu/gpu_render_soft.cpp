@@ -24,6 +24,8 @@
 #include "gpu_render_soft.h"
 
 const uint8_t GpuRenderSoft::paramCounts[] = { 1, 2, 2, 2, 3, 2, 2, 2, 3, 3 };
+const uint8_t GpuRenderSoft::colbufSizes[] = { 4, 3, 2, 2, 2, 0 };
+const uint8_t GpuRenderSoft::depbufSizes[] = { 2, 3, 4, 0 };
 SoftColor GpuRenderSoft::zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 SoftColor GpuRenderSoft::oneColor = { 1.0f, 1.0f, 1.0f, 1.0f };
 SoftColor GpuRenderSoft::stubColor = { 0.5f, 0.5f, 0.5f, 1.0f };
@@ -87,6 +89,114 @@ uint8_t GpuRenderSoft::stencilOp(uint8_t value, StenOper oper) {
     }
 }
 
+FORCE_INLINE bool GpuRenderSoft::testDepth(TestFunc func, uint32_t value, uint32_t depth) {
+    // Compare an incoming depth value with the current one
+    switch (func) {
+        case TEST_NV: return false;
+        case TEST_AL: return true;
+        case TEST_EQ: return (value == depth);
+        case TEST_NE: return (value != depth);
+        case TEST_LT: return (value < depth);
+        case TEST_LE: return (value <= depth);
+        case TEST_GT: return (value > depth);
+        default: return (value >= depth);
+    }
+}
+
+template <typename T> FORCE_INLINE T GpuRenderSoft::readBuf(uint8_t *data, uint32_t address, uint32_t ofs) {
+    // Read an LSB-first value from a render buffer, directly if it has a host pointer
+    if (!data) return core->memory.read<T>(ARM11, address + ofs);
+    T value = 0;
+    for (uint32_t i = 0; i < sizeof(T); i++)
+        value |= data[ofs + i] << (i << 3);
+    return value;
+}
+
+template <typename T> FORCE_INLINE void GpuRenderSoft::writeBuf(uint8_t *data, uint32_t address, uint32_t ofs, T value) {
+    // Write an LSB-first value to a render buffer, directly if it has a host pointer
+    if (!data) return core->memory.write<T>(ARM11, address + ofs, value);
+    for (uint32_t i = 0; i < sizeof(T); i++)
+        data[ofs + i] = value >> (i << 3);
+}
+
+void GpuRenderSoft::updateBuffers() {
+    // Resolve host pointers for the color and depth buffers, or use memory accessors if not contiguous
+    uint32_t pixels = bufWidth * bufHeight;
+    colbufPtr = core->memory.getHostPtr(colbufAddr, pixels * colbufSizes[colbufFmt], true);
+    depbufPtr = core->memory.getHostPtr(depbufAddr, pixels * depbufSizes[depbufFmt], true);
+    bufVersion = core->memory.mapVersion;
+    bufDirty = false;
+
+    // Resize and invalidate the per-tile depth bounds
+    uint32_t tiles = ((bufWidth >> 3) + 1) * ((bufHeight >> 3) + 1);
+    hizMin.resize(tiles);
+    hizMax.resize(tiles);
+    hizTags.resize(tiles);
+    hizGen++;
+
+    // Allow skipping draws on skipped frames if the color buffer only ends up on screen
+    drawSkip = frameSkip && displaySrcs.count(colbufAddr);
+}
+
+FORCE_INLINE uint32_t GpuRenderSoft::readDepth(uint32_t ofs) {
+    // Read a depth value from the buffer based on format
+    switch (depbufFmt) {
+    case DEP_16:
+        return readBuf<uint16_t>(depbufPtr, depbufAddr, ofs * 2);
+    case DEP_24:
+        return readBuf<uint16_t>(depbufPtr, depbufAddr, ofs * 3) |
+            (readBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 3 + 2) << 16);
+    case DEP_24S8:
+        return readBuf<uint32_t>(depbufPtr, depbufAddr, ofs * 4) & 0xFFFFFF;
+    default:
+        return 0;
+    }
+}
+
+FORCE_INLINE uint32_t GpuRenderSoft::scaleDepth(float z) {
+    // Scale an incoming depth value based on buffer format
+    return std::max<int>(0, z * ((depbufFmt == DEP_16) ? -0xFFFF : -0xFFFFFF));
+}
+
+void GpuRenderSoft::updateTile(uint32_t tile) {
+    // Rebuild the depth bounds of an 8x8 tile from the buffer
+    uint32_t min = -1, max = 0;
+    for (uint32_t ofs = tile << 6; ofs < (tile + 1) << 6; ofs++) {
+        uint32_t depth = readDepth(ofs);
+        min = std::min(min, depth);
+        max = std::max(max, depth);
+    }
+    hizMin[tile] = min;
+    hizMax[tile] = max;
+    hizTags[tile] = hizGen;
+}
+
+FORCE_INLINE bool GpuRenderSoft::tileRejects(uint32_t tile) {
+    // Check if the triangle's depth range can't pass anywhere against an 8x8 tile's bounds
+    if (hizTags[tile] != hizGen) updateTile(tile);
+    switch (depthFunc) {
+        case TEST_LT: return (triMin >= hizMax[tile]);
+        case TEST_LE: return (triMin > hizMax[tile]);
+        case TEST_GT: return (triMax <= hizMin[tile]);
+        default: return (triMax < hizMin[tile]);
+    }
+}
+
+FORCE_INLINE int GpuRenderSoft::earlyDepth(float x, float y, float z) {
+    // Check bounds and get the pixel's 8x8 tile
+    int px = int(x), py = flipY ? (bufHeight - int(y) - 1) : int(y);
+    if (px < 0 || px >= bufWidth || py < 0 || py >= bufHeight) return 1;
+    uint32_t tile = (py >> 3) * (bufWidth >> 3) + (px >> 3);
+
+    // Reject the rest of the tile if the triangle's depth range can't pass against its bounds
+    if (depthFunc >= TEST_LT && tileRejects(tile))
+        return 2;
+
+    // Reject the pixel if it fails the depth test
+    uint32_t ofs = (tile << 6) | swizzleX[px & 0x7] | swizzleY[py & 0x7];
+    return testDepth(depthFunc, scaleDepth(z), readDepth(ofs)) ? 0 : 1;
+}
+
 void GpuRenderSoft::updateTexel(int i, float s, float t) {
     // Catch silly invalid textures like in Pokemon X/Y
     if (!texWidths[i] || !texHeights[i]) {
@@ -135,12 +245,14 @@ void GpuRenderSoft::updateTexel(int i, float s, float t) {
     }
 
     // Use the cached texel if coordinates are unchanged
-    if (lastU[i] == u && lastV[i] == v)
+    core->gpu.statCounts[STAT_TEXELS]++;
+    if (lastU[i] == u && lastV[i] == v) {
+        core->gpu.statCounts[STAT_TEX_HITS]++;
         return;
+    }
 
     // Convert the texture coordinates to a swizzled memory offset
-    uint32_t value, ofs = (u & 0x1) | ((u << 1) & 0x4) | ((u << 2) & 0x10);
-    ofs |= ((v << 1) & 0x2) | ((v << 2) & 0x8) | ((v << 3) & 0x20);
+    uint32_t value, ofs = swizzleX[u & 0x7] | swizzleY[v & 0x7];
     ofs += ((v & ~0x7) * texWidths[i]) + ((u & ~0x7) << 3);
 
     // Read a texel and convert it to floats based on format
@@ -219,52 +331,26 @@ void GpuRenderSoft::updateTexel(int i, float s, float t) {
         break;
 
     case TEX_ETC1: case TEX_ETC1A4:
-        // Adjust the offset for 4x4 ETC1 tiles and read alpha if provided
-        uint8_t idx = (u & 0x3) * 4 + (v & 0x3);
-        if (texFmts[i] == TEX_ETC1A4) {
-            ofs = (ofs & ~0xF) + 8;
-            value = core->memory.read<uint8_t>(ARM11, texAddrs[i] + ofs - 8 + idx / 2);
-            texColors[i].a = float((value >> ((idx & 0x1) * 4)) & 0xF) / 0xF;
-        }
-        else {
-            ofs = (ofs & ~0xF) >> 1;
-            texColors[i].a = 1.0f;
-        }
-
-        // Decode an ETC1 texel based on the block it falls in and the base color mode
-        int32_t val1 = core->memory.read<uint32_t>(ARM11, texAddrs[i] + ofs + 0);
-        int32_t val2 = core->memory.read<uint32_t>(ARM11, texAddrs[i] + ofs + 4);
-        if ((((val2 & BIT(0)) ? v : u) & 0x3) < 2) { // Block 1
-            int16_t tbl = etc1Tables[(val2 >> 5) & 0x7][((val1 >> (idx + 15)) & 0x2) | ((val1 >> idx) & 0x1)];
-            if (val2 & BIT(1)) { // Differential
-                texColors[i].r = float(((val2 >> 27) & 0x1F) * 0x21 / 4 + tbl);
-                texColors[i].g = float(((val2 >> 19) & 0x1F) * 0x21 / 4 + tbl);
-                texColors[i].b = float(((val2 >> 11) & 0x1F) * 0x21 / 4 + tbl);
-            }
-            else { // Individual
-                texColors[i].r = float(((val2 >> 28) & 0xF) * 0x11 + tbl);
-                texColors[i].g = float(((val2 >> 20) & 0xF) * 0x11 + tbl);
-                texColors[i].b = float(((val2 >> 12) & 0xF) * 0x11 + tbl);
-            }
-        }
-        else { // Block 2
-            int16_t tbl = etc1Tables[(val2 >> 2) & 0x7][((val1 >> (idx + 15)) & 0x2) | ((val1 >> idx) & 0x1)];
-            if (val2 & BIT(1)) { // Differential
-                texColors[i].r = float((((val2 >> 27) & 0x1F) + (int8_t(val2 >> 19) >> 5)) * 0x21 / 4 + tbl);
-                texColors[i].g = float((((val2 >> 19) & 0x1F) + (int8_t(val2 >> 11) >> 5)) * 0x21 / 4 + tbl);
-                texColors[i].b = float((((val2 >> 11) & 0x1F) + (int8_t(val2 >> 3) >> 5)) * 0x21 / 4 + tbl);
-            }
-            else { // Individual
-                texColors[i].r = float(((val2 >> 24) & 0xF) * 0x11 + tbl);
-                texColors[i].g = float(((val2 >> 16) & 0xF) * 0x11 + tbl);
-                texColors[i].b = float(((val2 >> 8) & 0xF) * 0x11 + tbl);
+        // Decode the whole 8x8 tile containing the texel if it isn't cached
+        if (etc1Tiles[i] != (ofs >> 6)) {
+            uint32_t size = (texFmts[i] == TEX_ETC1A4) ? 64 : 32, addr = texAddrs[i] + (ofs >> 6) * size;
+            uint8_t data[64];
+            const uint8_t *src = core->memory.getHostPtr(addr, size, false);
+            if (!src) {
+                for (uint32_t j = 0; j < size; j++)
+                    data[j] = core->memory.read<uint8_t>(ARM11, addr + j);
+                src = data;
             }
+            (size == 64) ? decodeEtc1<true>(src, etc1Texels[i]) : decodeEtc1<false>(src, etc1Texels[i]);
+            etc1Tiles[i] = (ofs >> 6);
         }
 
-        // Normalize and clamp the final color values
-        texColors[i].r = std::min(1.0f, std::max(0.0f, texColors[i].r / 255));
-        texColors[i].g = std::min(1.0f, std::max(0.0f, texColors[i].g / 255));
-        texColors[i].b = std::min(1.0f, std::max(0.0f, texColors[i].b / 255));
+        // Convert the decoded texel to floats
+        value = etc1Texels[i][(v & 0x7) * 8 + (u & 0x7)];
+        texColors[i].r = float((value >> 24) & 0xFF) / 0xFF;
+        texColors[i].g = float((value >> 16) & 0xFF) / 0xFF;
+        texColors[i].b = float((value >> 8) & 0xFF) / 0xFF;
+        texColors[i].a = float((value >> 0) & 0xFF) / 0xFF;
         break;
     }
 
@@ -516,15 +602,15 @@ void GpuRenderSoft::drawPixel(SoftVertex &p) {
     int x = int(p.x), y = flipY ? (bufHeight - int(p.y) - 1) : int(p.y);
     if (x < 0 || x >= bufWidth || y < 0 || y >= bufHeight) return;
     uint32_t val, ofs = (((y >> 3) * (bufWidth >> 3) + (x >> 3)) << 6);
-    ofs |= ((y << 3) & 0x20) | ((y << 2) & 0x8) | ((y << 1) & 0x2);
-    ofs |= ((x << 2) & 0x10) | ((x << 1) & 0x4) | (x & 0x1);
+    ofs |= swizzleX[x & 0x7] | swizzleY[y & 0x7];
+    core->gpu.statCounts[STAT_FRAGS]++;
 
     // Perform stencil testing on the pixel if enabled
     uint8_t stencil = 0;
     if (stencilEnable) {
         // Read and mask the buffer and reference values
         if (depbufFmt == DEP_24S8)
-            stencil = core->memory.read<uint8_t>(ARM11, depbufAddr + ofs * 4 + 3) & stencilMasks[0];
+            stencil = readBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 4 + 3) & stencilMasks[0];
         uint8_t ref = (stencilValue & stencilMasks[1]);
 
         // Compare the incoming stencil value with the reference
@@ -543,50 +629,26 @@ void GpuRenderSoft::drawPixel(SoftVertex &p) {
         // If failed, perform the fail operation on the buffer and don't draw
         if (!pass) {
             if (depbufFmt == DEP_24S8)
-                core->memory.write<uint8_t>(ARM11, depbufAddr + ofs * 4 + 3, stencilOp(stencil, stencilFail));
+                writeBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 4 + 3, stencilOp(stencil, stencilFail));
             return;
         }
-    }
-
-    // Read the current depth and scale the incoming value based on buffer format
-    uint32_t depth = 0;
-    switch (depbufFmt) {
-    case DEP_16:
-        depth = core->memory.read<uint16_t>(ARM11, depbufAddr + ofs * 2);
-        val = std::max<int>(0, p.z * -0xFFFF);
-        break;
-    case DEP_24:
-        depth = core->memory.read<uint32_t>(ARM11, depbufAddr + ofs * 3) & 0xFFFFFF;
-        val = std::max<int>(0, p.z * -0xFFFFFF);
-        break;
-    case DEP_24S8:
-        depth = core->memory.read<uint32_t>(ARM11, depbufAddr + ofs * 4) & 0xFFFFFF;
-        val = std::max<int>(0, p.z * -0xFFFFFF);
-        break;
+        core->gpu.statCounts[STAT_STENCIL_PASS]++;
     }
 
     // Compare the incoming depth value with the current one
-    bool pass;
-    switch (depthFunc) {
-        case TEST_NV: pass = false; break;
-        case TEST_AL: pass = true; break;
-        case TEST_EQ: pass = (val == depth); break;
-        case TEST_NE: pass = (val != depth); break;
-        case TEST_LT: pass = (val < depth); break;
-        case TEST_LE: pass = (val <= depth); break;
-        case TEST_GT: pass = (val > depth); break;
-        case TEST_GE: pass = (val >= depth); break;
-    }
+    val = scaleDepth(p.z);
+    bool pass = testDepth(depthFunc, val, readDepth(ofs));
 
     // Perform the stencil depth pass/fail operation if enabled, and don't draw if failed
     if (!pass) {
         if (stencilEnable && depbufFmt == DEP_24S8)
-            core->memory.write<uint8_t>(ARM11, depbufAddr + ofs * 4 + 3, stencilOp(stencil, stenDepFail));
+            writeBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 4 + 3, stencilOp(stencil, stenDepFail));
         return;
     }
     else if (stencilEnable && depbufFmt == DEP_24S8) {
-        core->memory.write<uint8_t>(ARM11, depbufAddr + ofs * 4 + 3, stencilOp(stencil, stenDepPass));
+        writeBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 4 + 3, stencilOp(stencil, stenDepPass));
     }
+    core->gpu.statCounts[STAT_DEPTH_PASS]++;
 
     // Get source color values from the texture combiner
     updateCombine(p);
@@ -608,50 +670,57 @@ void GpuRenderSoft::drawPixel(SoftVertex &p) {
     if (depbufMask & BIT(1)) {
         switch (depbufFmt) {
         case DEP_16:
-            core->memory.write<uint16_t>(ARM11, depbufAddr + ofs * 2, val);
+            writeBuf<uint16_t>(depbufPtr, depbufAddr, ofs * 2, val);
             break;
         case DEP_24:
-            val |= core->memory.read<uint8_t>(ARM11, depbufAddr + ofs * 3 + 3) << 24;
-            core->memory.write<uint32_t>(ARM11, depbufAddr + ofs * 3, val);
+            writeBuf<uint16_t>(depbufPtr, depbufAddr, ofs * 3, val);
+            writeBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 3 + 2, val >> 16);
             break;
         case DEP_24S8:
-            val |= core->memory.read<uint8_t>(ARM11, depbufAddr + ofs * 4 + 3) << 24;
-            core->memory.write<uint32_t>(ARM11, depbufAddr + ofs * 4, val);
+            writeBuf<uint16_t>(depbufPtr, depbufAddr, ofs * 4, val);
+            writeBuf<uint8_t>(depbufPtr, depbufAddr, ofs * 4 + 2, val >> 16);
             break;
         }
+
+        // Widen the tile's depth bounds to include the new value
+        uint32_t tile = ofs >> 6;
+        if (hizTags[tile] == hizGen) {
+            hizMin[tile] = std::min(hizMin[tile], val);
+            hizMax[tile] = std::max(hizMax[tile], val);
+        }
     }
 
     // Read color values to blend with based on buffer format
     switch (colbufFmt) {
     case COL_RGBA8:
-        val = core->memory.read<uint32_t>(ARM11, colbufAddr + ofs * 4);
+        val = readBuf<uint32_t>(colbufPtr, colbufAddr, ofs * 4);
         d0.r = float((val >> 24) & 0xFF) / 0xFF;
         d0.g = float((val >> 16) & 0xFF) / 0xFF;
         d0.b = float((val >> 8) & 0xFF) / 0xFF;
         d0.a = float((val >> 0) & 0xFF) / 0xFF;
         break;
     case COL_RGB8:
-        d0.r = float(core->memory.read<uint8_t>(ARM11, colbufAddr + ofs * 3 + 2)) / 0xFF;
-        d0.g = float(core->memory.read<uint8_t>(ARM11, colbufAddr + ofs * 3 + 1)) / 0xFF;
-        d0.b = float(core->memory.read<uint8_t>(ARM11, colbufAddr + ofs * 3 + 0)) / 0xFF;
+        d0.r = float(readBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 2)) / 0xFF;
+        d0.g = float(readBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 1)) / 0xFF;
+        d0.b = float(readBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 0)) / 0xFF;
         d0.a = 1.0f;
         break;
     case COL_RGB565:
-        val = core->memory.read<uint16_t>(ARM11, colbufAddr + ofs * 2);
+        val = readBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2);
         d0.r = float((val >> 11) & 0x1F) / 0x1F;
         d0.g = float((val >> 5) & 0x3F) / 0x3F;
         d0.b = float((val >> 0) & 0x1F) / 0x1F;
         d0.a = 1.0f;
         break;
     case COL_RGB5A1:
-        val = core->memory.read<uint16_t>(ARM11, colbufAddr + ofs * 2);
+        val = readBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2);
         d0.r = float((val >> 11) & 0x1F) / 0x1F;
         d0.g = float((val >> 6) & 0x1F) / 0x1F;
         d0.b = float((val >> 1) & 0x1F) / 0x1F;
         d0.a = (val & BIT(0)) ? 1.0f : 0.0f;
         break;
     case COL_RGBA4:
-        val = core->memory.read<uint16_t>(ARM11, colbufAddr + ofs * 2);
+        val = readBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2);
         d0.r = float((val >> 12) & 0xF) / 0xF;
         d0.g = float((val >> 8) & 0xF) / 0xF;
         d0.b = float((val >> 4) & 0xF) / 0xF;
@@ -761,28 +830,30 @@ void GpuRenderSoft::drawPixel(SoftVertex &p) {
     switch (colbufFmt) {
     case COL_RGBA8:
         val = (int(r * 255) << 24) | (int(g * 255) << 16) | (int(b * 255) << 8) | int(a * 255);
-        return core->memory.write<uint32_t>(ARM11, colbufAddr + ofs * 4, val);
+        return writeBuf<uint32_t>(colbufPtr, colbufAddr, ofs * 4, val);
     case COL_RGB8:
-        core->memory.write<uint8_t>(ARM11, colbufAddr + ofs * 3 + 2, r * 255);
-        core->memory.write<uint8_t>(ARM11, colbufAddr + ofs * 3 + 1, g * 255);
-        return core->memory.write<uint8_t>(ARM11, colbufAddr + ofs * 3 + 0, b * 255);
+        writeBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 2, r * 255);
+        writeBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 1, g * 255);
+        return writeBuf<uint8_t>(colbufPtr, colbufAddr, ofs * 3 + 0, b * 255);
     case COL_RGB565:
         val = (int(r * 31) << 11) | (int(g * 63) << 5) | int(b * 31);
-        return core->memory.write<uint16_t>(ARM11, colbufAddr + ofs * 2, val);
+        return writeBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2, val);
     case COL_RGB5A1:
         val = (int(r * 31) << 11) | (int(g * 31) << 6) | (int(b * 31) << 1) | (a > 0);
-        return core->memory.write<uint16_t>(ARM11, colbufAddr + ofs * 2, val);
+        return writeBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2, val);
     case COL_RGBA4:
         val = (int(r * 15) << 12) | (int(g * 15) << 8) | (int(b * 15) << 4) | int(a * 15);
-        return core->memory.write<uint16_t>(ARM11, colbufAddr + ofs * 2, val);
+        return writeBuf<uint16_t>(colbufPtr, colbufAddr, ofs * 2, val);
     }
 }
 
 void GpuRenderSoft::drawTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c) {
     // Cull triangles by determining their orientation with a cross product
     float cross = ((b.y - a.y) * (c.x - b.x)) - ((b.x - a.x) * (c.y - b.y));
-    if (!std::isfinite(cross) || (cullMode == CULL_FRONT && (cross < 0)) || (cullMode == CULL_BACK && (cross > 0)))
+    if (!std::isfinite(cross) || (cullMode == CULL_FRONT && (cross < 0)) || (cullMode == CULL_BACK && (cross > 0))) {
+        core->gpu.statCounts[STAT_CULLED]++;
         return;
+    }
 
     // Scale the coordinate steps to screen space
     if (viewStepH <= 0 || viewStepV <= 0) return;
@@ -795,6 +866,13 @@ void GpuRenderSoft::drawTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c) {
     if (v[0]->y > v[2]->y) std::swap(v[0], v[2]);
     if (v[1]->y > v[2]->y) std::swap(v[1], v[2]);
 
+    // Resolve buffer pointers if their parameters or the memory map changed
+    if (bufDirty || bufVersion != core->memory.mapVersion)
+        updateBuffers();
+
+    // Skip the triangle on skipped frames unless it can write depth or stencil values
+    if (drawSkip && !depbufMask && !stencilEnable) return;
+
     // Check if the texture combiner cache is dirty
     if (combEnd > 5) {
         // Skip over combiners set to simply output the previous color
@@ -811,6 +889,34 @@ void GpuRenderSoft::drawTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c) {
         cacheCombA(combEnd);
     }
 
+    // Allow testing depth before interpolating pixels if a failed test has no stencil side effects
+    bool early = (depthFunc != TEST_AL && depbufFmt != DEP_UNK && !(stencilEnable && depbufFmt == DEP_24S8)
+        && !((bufWidth | bufHeight) & 0x7));
+    if (early) {
+        // Get the triangle's depth range with a margin for rounding
+        triMin = std::min(scaleDepth(v[0]->z), std::min(scaleDepth(v[1]->z), scaleDepth(v[2]->z)));
+        triMax = std::max(scaleDepth(v[0]->z), std::max(scaleDepth(v[1]->z), scaleDepth(v[2]->z)));
+        triMin = triMin ? (triMin - 1) : 0;
+        triMax = triMax + 1;
+
+        // Skip the whole triangle if every tile covered by its bounding box rejects it
+        if (depthFunc >= TEST_LT) {
+            int x0 = std::max<int>(0, std::min(v[0]->x, std::min(v[1]->x, v[2]->x)));
+            int x1 = std::min<int>(bufWidth - 1, std::max(v[0]->x, std::max(v[1]->x, v[2]->x)));
+            int y0 = std::max<int>(0, v[0]->y), y1 = std::min<int>(bufHeight - 1, v[2]->y);
+            if (flipY) {
+                int y = y0;
+                y0 = bufHeight - y1 - 1;
+                y1 = bufHeight - y - 1;
+            }
+            bool reject = true;
+            for (int ty = (y0 >> 3); reject && ty <= (y1 >> 3); ty++)
+                for (int tx = (x0 >> 3); reject && tx <= (x1 >> 3); tx++)
+                    reject = tileRejects(ty * (bufWidth >> 3) + tx);
+            if (reject) return;
+        }
+    }
+
     // Draw the pixels of a triangle by interpolating between X and Y bounds
     for (float y = roundf(v[0]->y) + ys / 2; y < roundf(v[2]->y); y += ys) {
         int r = (y >= v[1]->y) ? 1 : 0;
@@ -818,21 +924,49 @@ void GpuRenderSoft::drawTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c) {
         SoftVertex vr = interpolate<true>(*v[r], *v[r + 1], v[r]->y, y, v[r + 1]->y);
         if (vl.x > vr.x) std::swap(vl, vr);
         for (float x = roundf(vl.x) + xs / 2; x < roundf(vr.x); x += xs) {
+            // Interpolate depth and skip the pixel, or the rest of its tile row, if it can't pass
+            float z = (x <= vl.x) ? vl.z : (x >= vr.x) ? vr.z : (vl.z + (vr.z - vl.z) * ((x - vl.x) / (vr.x - vl.x)));
+            if (early) {
+                switch (earlyDepth(x, y, z)) {
+                case 1: continue;
+                case 2:
+                    for (float end = (int(x) | 0x7) + 1; x + xs < end; x += xs);
+                    continue;
+                }
+            }
+
+            // Interpolate the rest of the pixel's attributes and draw it
             SoftVertex vm = interpolate<false>(vl, vr, vl.x, x, vr.x);
-            vm.x = x, vm.y = y;
+            vm.x = x, vm.y = y, vm.z = z;
             drawPixel(vm);
         }
     }
 }
 
+FORCE_INLINE uint8_t GpuRenderSoft::getOutcode(SoftVertex &v) {
+    // Set a bit for each of the 6 clip planes a vertex is outside of
+    return (!(v.x >= -v.w) << 0) | (!(-v.x >= -v.w) << 1) | (!(v.y >= -v.w) << 2) |
+        (!(-v.y >= -v.w) << 3) | (!(v.z >= -v.w) << 4) | (!(-v.z >= -v.w) << 5);
+}
+
 void GpuRenderSoft::clipTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c) {
     // Copy the vertices to an initial working buffer
     SoftVertex vert[10], clip[10];
     vert[0] = a, vert[1] = b, vert[2] = c;
     uint8_t size = 3;
 
+    // Reject triangles fully outside of any plane, and skip clipping ones fully inside
+    uint8_t codes[] = { getOutcode(a), getOutcode(b), getOutcode(c) };
+    core->gpu.statCounts[STAT_TRIS]++;
+    if (codes[0] & codes[1] & codes[2]) {
+        core->gpu.statCounts[STAT_CULLED]++;
+        return;
+    }
+    ClipResult result = (codes[0] | codes[1] | codes[2]) ? CLIP_PARTIAL : CLIP_INSIDE;
+    if (result == CLIP_PARTIAL) core->gpu.statCounts[STAT_CLIPPED]++;
+
     // Clip a triangle on 6 sides using the Sutherland-Hodgman algorithm
-    for (int i = 0; i < 6; i++) {
+    for (int i = 0; i < 6 && result == CLIP_PARTIAL; i++) {
         // Build a list of clipped vertices from the working ones
         uint8_t idx = 0;
         for (int j = 0; j < size; j++) {
@@ -936,6 +1070,36 @@ void GpuRenderSoft::submitVertex(SoftVertex &vertex) {
     }
 }
 
+void GpuRenderSoft::submitVertices(SoftVertex *list, uint32_t count) {
+    // Draw whole triangles straight from the list when separate triangles start fresh
+    uint32_t i = 0;
+    if ((primMode == TRIANGLES || primMode == GEO_PRIM) && !vtxCount)
+        for (; i + 3 <= count; i += 3)
+            clipTriangle(list[i], list[i + 1], list[i + 2]);
+
+    // Submit any remaining vertices one at a time
+    for (; i < count; i++)
+        submitVertex(list[i]);
+}
+
+void GpuRenderSoft::flushBuffers() {
+    // Invalidate depth bounds and decoded texels, since memory may be changed after this
+    hizGen++;
+    etc1Tiles[0] = etc1Tiles[1] = etc1Tiles[2] = -1;
+}
+
+void GpuRenderSoft::setFrameSkip(bool skip) {
+    // Set whether the current frame won't be presented and re-check the buffers
+    frameSkip = skip;
+    bufDirty = true;
+}
+
+void GpuRenderSoft::addDisplaySrc(uint32_t address) {
+    // Remember a color buffer that gets copied to the screen and re-check the buffers
+    if (displaySrcs.insert(address).second)
+        bufDirty = true;
+}
+
 void GpuRenderSoft::setPrimMode(PrimMode mode) {
     // Change primitive mode and reset the vertex count
     primMode = mode;
@@ -945,14 +1109,14 @@ void GpuRenderSoft::setPrimMode(PrimMode mode) {
 void GpuRenderSoft::setTexAddr(int i, uint32_t address) {
     // Set one of the texture addresses and invalidate its cache
     texAddrs[i] = address;
-    lastU[i] = lastV[i] = -1;
+    lastU[i] = lastV[i] = etc1Tiles[i] = -1;
 }
 
 void GpuRenderSoft::setTexDims(int i, uint16_t width, uint16_t height) {
     // Set one of the texture unit widths/heights and invalidate its cache
     texWidths[i] = width;
     texHeights[i] = height;
-    lastU[i] = lastV[i] = -1;
+    lastU[i] = lastV[i] = etc1Tiles[i] = -1;
 }
 
 void GpuRenderSoft::setTexBorder(int i, float r, float g, float b, float a) {
@@ -966,7 +1130,7 @@ void GpuRenderSoft::setTexBorder(int i, float r, float g, float b, float a) {
 void GpuRenderSoft::setTexFmt(int i, TexFmt format) {
     // Set one of the texture formats and invalidate its cache
     texFmts[i] = format;
-    lastU[i] = lastV[i] = -1;
+    lastU[i] = lastV[i] = etc1Tiles[i] = -1;
 }
 
 void GpuRenderSoft::setCombSrc(int i, int j, CombSrc src) {
@@ -1041,4 +1205,29 @@ void GpuRenderSoft::setBufferDims(uint16_t width, uint16_t height, bool flip) {
     bufWidth = width;
     bufHeight = height;
     flipY = flip;
+    bufDirty = true;
+}
+
+void GpuRenderSoft::setColbufAddr(uint32_t address) {
+    // Set the color buffer address and invalidate its pointer
+    colbufAddr = address;
+    bufDirty = true;
+}
+
+void GpuRenderSoft::setColbufFmt(ColbufFmt format) {
+    // Set the color buffer format and invalidate its pointer
+    colbufFmt = format;
+    bufDirty = true;
+}
+
+void GpuRenderSoft::setDepbufAddr(uint32_t address) {
+    // Set the depth buffer address and invalidate its pointer
+    depbufAddr = address;
+    bufDirty = true;
+}
+
+void GpuRenderSoft::setDepbufFmt(DepbufFmt format) {
+    // Set the depth buffer format and invalidate its pointer
+    depbufFmt = format;
+    bufDirty = true;
 }
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <cstdint>
+#include <set>
 #include <vector>
 
 #include "gpu_render.h"
@@ -46,7 +47,10 @@ public:
     GpuRenderSoft(Core *core): core(core) {}
 
     void submitVertex(SoftVertex &vertex);
-    void flushBuffers() {}
+    void submitVertices(SoftVertex *list, uint32_t count);
+    void flushBuffers();
+    void setFrameSkip(bool skip);
+    void addDisplaySrc(uint32_t address);
 
     void setPrimMode(PrimMode mode);
     void setCullMode(CullMode mode) { cullMode = mode; }
@@ -78,11 +82,11 @@ public:
     void setViewScaleV(float scale) { viewScaleV = scale; }
     void setViewStepV(float step) { viewStepV = step; }
     void setBufferDims(uint16_t width, uint16_t height, bool flip);
-    void setColbufAddr(uint32_t address) { colbufAddr = address; }
-    void setColbufFmt(ColbufFmt format) { colbufFmt = format; }
+    void setColbufAddr(uint32_t address);
+    void setColbufFmt(ColbufFmt format);
     void setColbufMask(uint8_t mask) { colbufMask = mask; }
-    void setDepbufAddr(uint32_t address) { depbufAddr = address; }
-    void setDepbufFmt(DepbufFmt format) { depbufFmt = format; }
+    void setDepbufAddr(uint32_t address);
+    void setDepbufFmt(DepbufFmt format);
     void setDepbufMask(uint8_t mask) { depbufMask = mask; }
     void setDepthFunc(TestFunc func) { depthFunc = func; }
 
@@ -90,6 +94,8 @@ private:
     Core *core;
 
     static const uint8_t paramCounts[MODE_UNK + 1];
+    static const uint8_t colbufSizes[COL_UNK + 1];
+    static const uint8_t depbufSizes[DEP_UNK + 1];
     static SoftColor zeroColor, oneColor;
     static SoftColor stubColor;
 
@@ -99,6 +105,8 @@ private:
     SoftColor primColor = {};
     int64_t lastU[3] = { -1, -1, -1 };
     int64_t lastV[3] = { -1, -1, -1 };
+    uint32_t etc1Texels[3][64] = {};
+    int64_t etc1Tiles[3] = { -1, -1, -1 };
     uint16_t paramMask = 0;
     uint16_t combMask = 0;
     uint8_t combEnd = -1;
@@ -149,9 +157,35 @@ private:
     uint8_t stencilValue = 0;
     bool stencilEnable = false;
 
+    uint8_t *colbufPtr = nullptr;
+    uint8_t *depbufPtr = nullptr;
+    uint32_t bufVersion = -1;
+    bool bufDirty = true;
+
+    std::vector<uint32_t> hizMin;
+    std::vector<uint32_t> hizMax;
+    std::vector<uint32_t> hizTags;
+    uint32_t hizGen = 1;
+    uint32_t triMin = 0;
+    uint32_t triMax = 0;
+
+    std::set<uint32_t> displaySrcs;
+    bool frameSkip = false;
+    bool drawSkip = false;
+
     template <bool doX> static SoftVertex interpolate(SoftVertex &v1, SoftVertex &v2, float x1, float x, float x2);
     static SoftVertex intersect(SoftVertex &v1, SoftVertex &v2, float x1, float x2);
     uint8_t stencilOp(uint8_t value, StenOper oper);
+    static bool testDepth(TestFunc func, uint32_t value, uint32_t depth);
+
+    template <typename T> T readBuf(uint8_t *data, uint32_t address, uint32_t ofs);
+    template <typename T> void writeBuf(uint8_t *data, uint32_t address, uint32_t ofs, T value);
+    void updateBuffers();
+    uint32_t readDepth(uint32_t ofs);
+    uint32_t scaleDepth(float z);
+    void updateTile(uint32_t tile);
+    bool tileRejects(uint32_t tile);
+    int earlyDepth(float x, float y, float z);
 
     void updateTexel(int i, float s, float t);
     void updateCombine(SoftVertex &v);
@@ -161,5 +195,6 @@ private:
 
     void drawPixel(SoftVertex &p);
     void drawTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c);
+    static uint8_t getOutcode(SoftVertex &v);
     void clipTriangle(SoftVertex &a, SoftVertex &b, SoftVertex &c);
 };
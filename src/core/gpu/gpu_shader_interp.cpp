@@ -23,6 +23,9 @@
 #include "../core.h"
 #include "gpu_render.h"
 
+template void GpuShaderInterp::compileShader<false>();
+template void GpuShaderInterp::updateFlow<false>(uint16_t);
+
 // Lookup table for vertex shader instructions
 void (GpuShaderInterp::*GpuShaderInterp::vshInstrs[])(ShaderCode&) {
     &GpuShaderInterp::shdAdd, &GpuShaderInterp::shdDp3, &GpuShaderInterp::shdDp4, &GpuShaderInterp::shdDph, // 0x00-0x03
@@ -79,8 +82,9 @@ GpuShaderInterp::GpuShaderInterp(GpuRender &gpuRender): gpuRender(gpuRender) {
 }
 
 void GpuShaderInterp::cacheCode(ShaderCode &code, uint32_t value, bool geo) {
-    // Cache an opcode's function pointer and value
+    // Cache an opcode's function pointers and value
     code.instr = (geo ? gshInstrs : vshInstrs)[value >> 26];
+    code.bat = batInstrs[value >> 26];
     code.value = value;
 
     // Cache an opcode's parameters based on format
@@ -91,14 +95,14 @@ void GpuShaderInterp::cacheCode(ShaderCode &code, uint32_t value, bool geo) {
     case 0x0C: case 0x0D: case 0x0E: case 0x0F:
     case 0x12: case 0x13: case 0x2E: case 0x2F: // Format 1
         code.desc = &(geo ? gshDesc : vshDesc)[value & 0x7F];
-        code.dst = dstRegs[(value >> 21) & 0x1F];
+        code.dst = dstRegs[code.dstReg = (value >> 21) & 0x1F];
         code.src[0] = (value >> 12) & 0x7F;
         code.src[1] = (value >> 7) & 0x1F;
         code.idx = (value >> 19) & 0x3;
         return;
     case 0x18: case 0x19: case 0x1A: case 0x1B: // Format 1i
         code.desc = &(geo ? gshDesc : vshDesc)[value & 0x7F];
-        code.dst = dstRegs[(value >> 21) & 0x1F];
+        code.dst = dstRegs[code.dstReg = (value >> 21) & 0x1F];
         code.src[0] = (value >> 14) & 0x1F;
         code.src[1] = (value >> 7) & 0x7F;
         code.idx = (value >> 19) & 0x3;
@@ -106,7 +110,7 @@ void GpuShaderInterp::cacheCode(ShaderCode &code, uint32_t value, bool geo) {
     case 0x38: case 0x39: case 0x3A: case 0x3B:
     case 0x3C: case 0x3D: case 0x3E: case 0x3F: // Format 5
         code.desc = &(geo ? gshDesc : vshDesc)[value & 0x1F];
-        code.dst = dstRegs[(value >> 24) & 0x1F];
+        code.dst = dstRegs[code.dstReg = (value >> 24) & 0x1F];
         code.src[0] = (value >> 17) & 0x1F;
         code.src[1] = (value >> 10) & 0x7F;
         code.src[2] = (value >> 5) & 0x1F;
@@ -115,7 +119,7 @@ void GpuShaderInterp::cacheCode(ShaderCode &code, uint32_t value, bool geo) {
     case 0x30: case 0x31: case 0x32: case 0x33:
     case 0x34: case 0x35: case 0x36: case 0x37: // Format 5i
         code.desc = &(geo ? gshDesc : vshDesc)[value & 0x1F];
-        code.dst = dstRegs[(value >> 24) & 0x1F];
+        code.dst = dstRegs[code.dstReg = (value >> 24) & 0x1F];
         code.src[0] = (value >> 17) & 0x1F;
         code.src[1] = (value >> 12) & 0x1F;
         code.src[2] = (value >> 5) & 0x7F;
@@ -132,114 +136,395 @@ void GpuShaderInterp::cacheDesc(ShaderDesc &desc, uint32_t value) {
         desc.src[i].map[2] = (value >> (i * 9 + 7)) & 0x3;
         desc.src[i].map[3] = (value >> (i * 9 + 5)) & 0x3;
         desc.src[i].negate = (value & BIT(i * 9 + 4));
+        desc.src[i].direct = ((value >> (i * 9 + 4)) & 0x1FF) == 0x36;
     }
 
     // Cache a descriptor's destination mask
     for (int i = 0; i < 4; i++)
         desc.dstMask[i] = (value & BIT(3 - i));
+    desc.fullMask = ((value & 0xF) == 0xF);
+}
+
+void GpuShaderInterp::syncVsh(GpuShaderInterp &src) {
+    // Copy the compiled vertex shader from another instance if it changed, pointing it at local registers
+    if (src.vshDirty) src.compileShader<false>();
+    if (syncVersion != src.vshVersion) {
+        memcpy(vshCode, src.vshCode, sizeof(vshCode));
+        memcpy(vshFlow, src.vshFlow, sizeof(vshFlow));
+        for (int i = 0; i < 0x200; i++) {
+            if (vshCode[i].desc) vshCode[i].desc = &vshDesc[vshCode[i].desc - src.vshDesc];
+            if (vshCode[i].dst) vshCode[i].dst = dstRegs[vshCode[i].dstReg];
+        }
+        vshOutEnd = src.vshOutEnd;
+        vshTmpEnd = src.vshTmpEnd;
+        vshDirty = false;
+        syncVersion = src.vshVersion;
+    }
+
+    // Copy the vertex shader state that can change without recompiling
+    memcpy(vshDesc, src.vshDesc, sizeof(vshDesc));
+    memcpy(vshFloats, src.vshFloats, sizeof(vshFloats));
+    memcpy(vshBools, src.vshBools, sizeof(vshBools));
+    memcpy(vshInts, src.vshInts, sizeof(vshInts));
+    memcpy(outMap, src.outMap, sizeof(outMap));
+    vshEntry = src.vshEntry;
+    vshEnd = src.vshEnd;
+    gshInCount = src.gshInCount;
 }
 
-void GpuShaderInterp::startList() {
+void GpuShaderInterp::startList(bool indexed) {
+    // Only cache vertices for indexed lists, since array indices are never reused
+    cacheEnable = indexed;
+
     // Increment the vertex tag to invalidate cache and reset on overflow to avoid false positives
     if (++vtxTag) return;
     memset(vtxCache, 0, sizeof(vtxCache));
     vtxTag = 1;
 }
 
-void GpuShaderInterp::processVtx(float (*input)[4], uint32_t idx) {
-    // Get an entry in the vertex cache, up to the first 256 in a list
-    idx = std::min<uint32_t>(0x100, idx);
-    VertexCache &cache = vtxCache[idx];
+VertexCache *GpuShaderInterp::findVtx(uint32_t idx) {
+    // Look up a vertex index in its cache set and count the result
+    if (!cacheEnable || idx > 0xFFFF) return nullptr;
+    VertexCache *set = vtxCache[(idx ^ (idx >> 8)) & 0xFF];
+    for (int i = 0; i < 4; i++) {
+        if (set[i].tag != vtxTag || set[i].idx != idx) continue;
+        vtxHits++;
+        return &set[i];
+    }
+    vtxMisses++;
+    return nullptr;
+}
 
-    // Skip processing the vertex if it's cached and not outdated
-    if (idx < 0x100 && cache.tag == vtxTag && !gshInCount)
-        return gpuRender.submitVertex(cache.vtx);
+VertexCache *GpuShaderInterp::addVtx(uint32_t idx) {
+    // Replace the oldest entry in a vertex index's cache set
+    if (!cacheEnable || idx > 0xFFFF) return nullptr;
+    uint8_t s = (idx ^ (idx >> 8)) & 0xFF;
+    VertexCache &cache = vtxCache[s][vtxNext[s]++ & 0x3];
+    cache.tag = vtxTag;
+    cache.idx = idx;
+    return &cache;
+}
 
-    // Update source registers and run the vertex shader
-    for (int i = 0x0; i < 0x10; i++)
-        vshRegs[i] = input[i];
-    runShader<false>();
+void GpuShaderInterp::submitVtx(SoftVertex &vertex) {
+    // Send a vertex to the renderer, or collect it to be submitted later
+    if (buffered)
+        vtxBuffer.push_back(vertex);
+    else
+        gpuRender.submitVertex(vertex);
+}
+
+void GpuShaderInterp::processVtx(float (*input)[4], uint32_t idx) {
+    // Update source registers and run the vertex shader if its output isn't cached
+    VertexCache *cache = findVtx(idx);
+    if (!cache) {
+        uint64_t time = Gpu::statClock();
+        for (int i = 0x0; i < 0x10; i++)
+            vshRegs[i] = input[i];
+        runShader<false>();
+        if (time) shadeTime += Gpu::statClock() - time;
+        if ((cache = addVtx(idx)))
+            memcpy(cache->out, shdOut, sizeof(shdOut));
+    }
 
-    // Cache and submit a vertex from the output if geometry shader is disabled
+    // Submit a vertex from the output if geometry shader is disabled
+    float (*out)[4] = cache ? cache->out : shdOut;
     if (!gshInCount) {
-        cache.tag = vtxTag;
-        buildVertex(cache.vtx);
-        return gpuRender.submitVertex(cache.vtx);
+        SoftVertex vertex;
+        buildVertex(vertex, out);
+        return submitVtx(vertex);
     }
 
     // Copy vertex output to geometry input until it's full
     for (int i = 0; i < gshInCount; i++) {
-        memcpy(gshInput[gshInMap[gshInTotal]], shdOut[i], 4 * sizeof(float));
+        memcpy(gshInput[gshInMap[gshInTotal]], out[i], 4 * sizeof(float));
         if (++gshInTotal >= 16 || gshInMap[gshInTotal] >= 16) goto geometry;
     }
     return;
 
 geometry:
     // Run the geometry shader and then switch back to vertex
+    uint64_t time = Gpu::statClock();
     srcRegs = gshRegs, shdInts = gshInts, shdBools = gshBools;
     runShader<true>();
     srcRegs = vshRegs, shdInts = vshInts, shdBools = vshBools;
     gshInTotal = 0;
+    if (time) shadeTime += Gpu::statClock() - time;
+}
+
+template <bool geo> void GpuShaderInterp::compileShader() {
+    // Configure constants that depend on shader type
+    const uint16_t mask = (geo ? 0xFFF : 0x1FF);
+    ShaderCode *code = (geo ? gshCode : vshCode);
+    bool *flow = (geo ? gshFlow : vshFlow);
+    bool *bools = (geo ? gshBools : vshBools);
+    void (GpuShaderInterp::*unk)(ShaderCode&) = (geo ? &GpuShaderInterp::gshUnk : &GpuShaderInterp::vshUnk);
+    memset(flow, 0, (mask + 1) * sizeof(bool));
+
+    // Find the outputs that are used, either as geometry shader input or through the output map
+    static const uint8_t sems[] = { 0x0, 0x1, 0x2, 0x3, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF, 0x16, 0x17 };
+    uint16_t live = 0;
+    if (!geo && gshInCount)
+        live = BIT(gshInCount) - 1;
+    else for (int i = 0; i < 14; i++)
+        live |= BIT(outMap[sems[i]][0]);
+    uint8_t outEnd = 0, tmpEnd = 0;
+    for (int i = 0; i < 16; i++)
+        if (live & BIT(i)) outEnd = i + 1;
+
+    for (int i = 0; i <= mask; i++) {
+        // Reset any specialization from the last compile
+        ShaderCode &op = code[i];
+        uint32_t value = op.value;
+        uint8_t opcode = (value >> 26);
+        op.instr = (geo ? gshInstrs : vshInstrs)[opcode];
+        op.bat = batInstrs[opcode];
+
+        // Resolve uniform branches ahead of time, and mark program counters where a call, if, or loop
+        // block can end so other ones skip stack checks
+        bool cond = bools[(value >> 22) & 0xF];
+        switch (opcode) {
+        case 0x26: // CALLU
+            if (!cond) {
+                op.instr = op.bat = &GpuShaderInterp::shdNop;
+                continue;
+            }
+            op.instr = op.bat = &GpuShaderInterp::shdCall;
+            flow[(((value >> 10) & 0xFFF) + (value & 0xFF)) & mask] = true;
+            continue;
+        case 0x24: case 0x25: // CALL
+            flow[(((value >> 10) & 0xFFF) + (value & 0xFF)) & mask] = true;
+            continue;
+        case 0x27: // IFU
+            if (!cond) {
+                op.instr = op.bat = &GpuShaderInterp::shdJmp;
+                continue;
+            }
+            op.instr = op.bat = &GpuShaderInterp::shdIf;
+            flow[(value >> 10) & mask] = true;
+            continue;
+        case 0x28: // IF
+            flow[(value >> 10) & mask] = true;
+            continue;
+        case 0x29: // LOOP
+            flow[((value >> 10) + 1) & mask] = true;
+            continue;
+        case 0x2D: // JMPU
+            op.instr = op.bat = (cond ? &GpuShaderInterp::shdJmp : &GpuShaderInterp::shdNop);
+            continue;
+        }
+
+        // Skip opcodes that don't use registers, including unknown ones so they still get logged
+        if ((opcode >= 0x20 && opcode < 0x2E) || op.instr == unk) continue;
+
+        // Track the highest temporary register read so only the ones in use have to be reset
+        for (int j = 0; j < ((opcode >= 0x30) ? 3 : 2); j++)
+            if (op.src[j] >= 0x10 && op.src[j] < 0x20 && op.src[j] - 0xF > tmpEnd)
+                tmpEnd = op.src[j] - 0xF;
+
+        // Track the highest temporary register written, and drop writes to unused outputs
+        if (opcode == 0x12 || opcode == 0x2E || opcode == 0x2F) continue; // MOVA, CMP
+        if (op.dstReg >= 0x10 && op.dstReg - 0xF > tmpEnd)
+            tmpEnd = op.dstReg - 0xF;
+        else if (op.dstReg < 0x10 && (~live & BIT(op.dstReg)))
+            op.instr = op.bat = &GpuShaderInterp::shdNop;
+    }
+
+    // Save the analysis results and mark the shader as up to date
+    (geo ? gshOutEnd : vshOutEnd) = outEnd;
+    (geo ? gshTmpEnd : vshTmpEnd) = tmpEnd;
+    (geo ? gshDirty : vshDirty) = false;
+    if (!geo) vshVersion++;
+}
+
+void GpuShaderInterp::queueVtx(float (*input)[4], uint32_t idx) {
+    // Reserve space to save the output of each queued vertex if it goes through the geometry shader
+    if (gshInCount && gshQueue.size() < (gshCount + batCount + 1) * gshInCount * 4)
+        gshQueue.resize((gshCount + batCount + 1) * gshInCount * 4);
+
+    // Output cached vertices right away, and submit them directly if nothing is queued before them
+    if (VertexCache *cache = findVtx(idx)) {
+        outputVtx(batCount, cache->out);
+        if (!batCount && !gshInCount)
+            return submitVtx(batVtx[0]);
+        batLane[batCount++] = -1;
+    }
+    else {
+        // Queue a vertex that needs shading, transposing its input into the next free lane
+        for (int i = 0; i < 16; i++)
+            for (int j = 0; j < 4; j++)
+                batIn[i][j][batLanes] = input[i][j];
+        batIdx[batCount] = idx;
+        batLane[batCount++] = batLanes++;
+    }
+
+    // Shade the queue once all lanes or entries are used
+    if (batLanes == 4 || batCount == 16)
+        shadeVtxs();
+}
+
+void GpuShaderInterp::flushVtxs() {
+    // Shade any queued vertices, then run the geometry shader over all of them if enabled
+    shadeVtxs();
+    if (gshCount) runGeometry();
+}
+
+void GpuShaderInterp::outputVtx(uint8_t i, float (*out)[4]) {
+    // Build a vertex from a queue entry's output, or save the output for the geometry shader
+    if (!gshInCount) return buildVertex(batVtx[i], out);
+    memcpy(&gshQueue[(gshCount + i) * gshInCount * 4], out, gshInCount * 4 * sizeof(float));
+}
+
+void GpuShaderInterp::shadeVtxs() {
+    // Pad unused lanes with the first one and run the vertex shader on all of them at once
+    if (!batCount) return;
+    if (batLanes) {
+        uint64_t time = Gpu::statClock();
+        for (int l = batLanes; l < 4; l++)
+            for (int i = 0; i < 16; i++)
+                for (int j = 0; j < 4; j++)
+                    batIn[i][j][l] = batIn[i][j][0];
+        bool batched = runBatch();
+
+        // Gather each lane's output, or run lanes one at a time if their control flow diverged
+        for (int i = 0; i < batCount; i++) {
+            int8_t l = batLane[i];
+            if (l < 0) continue;
+            if (batched) {
+                for (int j = 0; j < vshOutEnd; j++)
+                    for (int k = 0; k < 4; k++)
+                        shdOut[j][k] = batOut[j][k][l];
+            }
+            else {
+                float input[16][4];
+                for (int j = 0; j < 16; j++) {
+                    for (int k = 0; k < 4; k++)
+                        input[j][k] = batIn[j][k][l];
+                    vshRegs[j] = input[j];
+                }
+                runShader<false>();
+            }
+
+            // Cache the output and build a vertex from it
+            if (VertexCache *cache = addVtx(batIdx[i]))
+                memcpy(cache->out, shdOut, sizeof(shdOut));
+            outputVtx(i, shdOut);
+        }
+        if (time) shadeTime += Gpu::statClock() - time;
+    }
+
+    // Submit the queued vertices in order, or keep their outputs for the geometry shader
+    if (gshInCount)
+        gshCount += batCount;
+    else for (int i = 0; i < batCount; i++)
+        submitVtx(batVtx[i]);
+    batCount = batLanes = 0;
+}
+
+void GpuShaderInterp::runGeometry() {
+    // Switch to the geometry shader and collect emitted vertices so they can be submitted at once
+    uint64_t time = Gpu::statClock();
+    srcRegs = gshRegs, shdInts = gshInts, shdBools = gshBools;
+    bool direct = !buffered;
+    buffered = true;
+
+    // Copy saved vertex outputs to geometry inputs in order, running the shader each time they're full
+    for (uint32_t v = 0; v < gshCount; v++) {
+        float *out = &gshQueue[v * gshInCount * 4];
+        for (int i = 0; i < gshInCount; i++) {
+            memcpy(gshInput[gshInMap[gshInTotal]], &out[i * 4], 4 * sizeof(float));
+            if (++gshInTotal < 16 && gshInMap[gshInTotal] < 16) continue;
+            runShader<true>();
+            gshInTotal = 0;
+            break;
+        }
+    }
+
+    // Switch back to the vertex shader and submit the emitted vertices unless they're meant to stay buffered
+    srcRegs = vshRegs, shdInts = vshInts, shdBools = vshBools;
+    gshCount = 0;
+    if (time) shadeTime += Gpu::statClock() - time;
+    if (!direct) return;
+    buffered = false;
+    if (!vtxBuffer.empty())
+        gpuRender.submitVertices(&vtxBuffer[0], vtxBuffer.size());
+    vtxBuffer.clear();
 }
 
 template <bool geo> void GpuShaderInterp::runShader() {
     // Configure constants that depend on shader type
     const uint16_t mask = (geo ? 0xFFF : 0x1FF);
     ShaderCode *code = (geo ? gshCode : vshCode);
+    bool *flow = (geo ? gshFlow : vshFlow);
+
+    // Recompile the shader if its code or configuration changed since the last run
+    if (geo ? gshDirty : vshDirty)
+        compileShader<geo>();
 
     // Set the initial PC and stop address for the shader
     shdPc = (geo ? gshEntry : vshEntry);
     shdStop = (geo ? gshEnd : vshEnd);
 
-    // Reset the general shader state
-    memset(shdTmp, 0, sizeof(shdTmp));
-    memset(shdOut, 0, sizeof(shdOut));
+    // Reset the general shader state, limited to registers the shader can use
+    memset(shdTmp, 0, (geo ? gshTmpEnd : vshTmpEnd) * sizeof(shdTmp[0]));
+    memset(shdOut, 0, (geo ? gshOutEnd : vshOutEnd) * sizeof(shdOut[0]));
     memset(shdAddr, 0, sizeof(shdAddr));
     memset(shdCond, 0, sizeof(shdCond));
-    ifStack = callStack = {};
+    loopStack.clear();
+    ifStack.clear();
+    callStack.clear();
 
     // Execute the current shader until completion
+    uint32_t count = 0;
     while (shdPc != shdStop) {
         // Run an opcode and increment the program counter
         ShaderCode *op = &code[shdPc & mask];
         uint16_t cmpPc = ++shdPc;
         (this->*op->instr)(*op);
+        if (flow[cmpPc & mask]) updateFlow<geo>(cmpPc);
+        count++;
+    }
+    instrCount += count;
+}
 
-        // Check the program counter against flow stacks and pop on match
-        while (!callStack.empty() && !((cmpPc ^ callStack.front()) & mask))
-            shdPc = (callStack.front() >> 16), callStack.pop_front(); // Multiple checks
-        if (!ifStack.empty() && !((cmpPc ^ ifStack.front()) & mask))
-            shdPc = (ifStack.front() >> 16), ifStack.pop_front(); // Single check
-
-        // Adjust the loop counter and loop again or end on program counter match
-        if (!loopStack.empty() && !((cmpPc ^ loopStack.front()) & mask)) {
-            op = &code[((loopStack.front() >> 12) - 1) & mask];
-            shdAddr[2] += shdInts[(op->value >> 22) & 0x3][2];
-            shdPc = (loopStack.front() >> 12) & 0xFFF;
-            if (loopStack.front() >> 24)
-                loopStack[loopStack.size() - 1] -= BIT(24);
-            else
-                loopStack.pop_front();
-        }
+template <bool geo> void GpuShaderInterp::updateFlow(uint16_t cmpPc) {
+    // Configure constants that depend on shader type
+    const uint16_t mask = (geo ? 0xFFF : 0x1FF);
+    ShaderCode *code = (geo ? gshCode : vshCode);
+
+    // Check the program counter against flow stacks and pop on match
+    while (!callStack.empty() && !((cmpPc ^ callStack.front()) & mask))
+        shdPc = (callStack.front() >> 16), callStack.pop(); // Multiple checks
+    if (!ifStack.empty() && !((cmpPc ^ ifStack.front()) & mask))
+        shdPc = (ifStack.front() >> 16), ifStack.pop(); // Single check
+
+    // Adjust the loop counter and loop again or end on program counter match
+    if (!loopStack.empty() && !((cmpPc ^ loopStack.front()) & mask)) {
+        ShaderCode *op = &code[((loopStack.front() >> 12) - 1) & mask];
+        shdAddr[2] += shdInts[(op->value >> 22) & 0x3][2];
+        shdPc = (loopStack.front() >> 12) & 0xFFF;
+        if (loopStack.front() >> 24)
+            loopStack.front() -= BIT(24);
+        else
+            loopStack.pop();
     }
 }
 
-void GpuShaderInterp::buildVertex(SoftVertex &vertex) {
+void GpuShaderInterp::buildVertex(SoftVertex &vertex, float (*out)[4]) {
     // Build a vertex using the shader output map
-    vertex.x = shdOut[outMap[0x0][0]][outMap[0x0][1]];
-    vertex.y = shdOut[outMap[0x1][0]][outMap[0x1][1]];
-    vertex.z = shdOut[outMap[0x2][0]][outMap[0x2][1]];
-    vertex.w = shdOut[outMap[0x3][0]][outMap[0x3][1]];
-    vertex.r = shdOut[outMap[0x8][0]][outMap[0x8][1]];
-    vertex.g = shdOut[outMap[0x9][0]][outMap[0x9][1]];
-    vertex.b = shdOut[outMap[0xA][0]][outMap[0xA][1]];
-    vertex.a = shdOut[outMap[0xB][0]][outMap[0xB][1]];
-    vertex.s0 = shdOut[outMap[0xC][0]][outMap[0xC][1]];
-    vertex.t0 = shdOut[outMap[0xD][0]][outMap[0xD][1]];
-    vertex.s1 = shdOut[outMap[0xE][0]][outMap[0xE][1]];
-    vertex.t1 = shdOut[outMap[0xF][0]][outMap[0xF][1]];
-    vertex.s2 = shdOut[outMap[0x16][0]][outMap[0x16][1]];
-    vertex.t2 = shdOut[outMap[0x17][0]][outMap[0x17][1]];
+    vertex.x = out[outMap[0x0][0]][outMap[0x0][1]];
+    vertex.y = out[outMap[0x1][0]][outMap[0x1][1]];
+    vertex.z = out[outMap[0x2][0]][outMap[0x2][1]];
+    vertex.w = out[outMap[0x3][0]][outMap[0x3][1]];
+    vertex.r = out[outMap[0x8][0]][outMap[0x8][1]];
+    vertex.g = out[outMap[0x9][0]][outMap[0x9][1]];
+    vertex.b = out[outMap[0xA][0]][outMap[0xA][1]];
+    vertex.a = out[outMap[0xB][0]][outMap[0xB][1]];
+    vertex.s0 = out[outMap[0xC][0]][outMap[0xC][1]];
+    vertex.t0 = out[outMap[0xD][0]][outMap[0xD][1]];
+    vertex.s1 = out[outMap[0xE][0]][outMap[0xE][1]];
+    vertex.t1 = out[outMap[0xF][0]][outMap[0xF][1]];
+    vertex.s2 = out[outMap[0x16][0]][outMap[0x16][1]];
+    vertex.t2 = out[outMap[0x17][0]][outMap[0x17][1]];
 }
 
 float GpuShaderInterp::mult(float a, float b) {
@@ -262,6 +547,12 @@ template <bool relative> float *GpuShaderInterp::getSrc(ShaderCode &op, int i) {
         }
     }
 
+    // Copy a source register directly if it has no swizzle or negation
+    if (desc.direct) {
+        memcpy(value, srcRegs[src], 4 * sizeof(float));
+        return value;
+    }
+
     // Swizzle and negate a source register based on its descriptor
     if (desc.negate) {
         value[0] = -srcRegs[src][desc.map[0]];
@@ -279,7 +570,11 @@ template <bool relative> float *GpuShaderInterp::getSrc(ShaderCode &op, int i) {
 }
 
 void GpuShaderInterp::setDst(ShaderCode &op, float *value) {
-    // Set a destination register using the descriptor mask
+    // Set a destination register using the descriptor mask, or copy it whole if unmasked
+    if (op.desc->fullMask) {
+        memcpy(op.dst, value, 4 * sizeof(float));
+        return;
+    }
     bool *mask = op.desc->dstMask;
     if (mask[0]) op.dst[0] = value[0];
     if (mask[1]) op.dst[1] = value[1];
@@ -450,7 +745,7 @@ void GpuShaderInterp::shdBreak(ShaderCode &op) {
     // Jump to the end of a loop and finish it
     if (loopStack.empty()) return;
     shdPc = (loopStack.front() & 0xFFF);
-    loopStack.pop_front();
+    loopStack.pop();
 }
 
 void GpuShaderInterp::shdNop(ShaderCode &op) {
@@ -475,14 +770,13 @@ void GpuShaderInterp::shdBreakc(ShaderCode &op) {
     // If true, jump to the end of a loop and finish it
     if (loopStack.empty()) return;
     shdPc = (loopStack.front() & 0xFFF);
-    loopStack.pop_front();
+    loopStack.pop();
 }
 
 void GpuShaderInterp::shdCall(ShaderCode &op) {
     // Jump to an address and run a set number of opcodes
     uint16_t dst = (op.value >> 10) & 0xFFF;
-    callStack.push_front((shdPc << 16) | (dst + (op.value & 0xFF)));
-    if (callStack.size() > 4) callStack.pop_back(); // 4-deep
+    callStack.push((shdPc << 16) | (dst + (op.value & 0xFF)));
     shdPc = dst;
 }
 
@@ -498,8 +792,7 @@ void GpuShaderInterp::shdCallc(ShaderCode &op) {
 
     // If true, jump to an address and run a set number of opcodes
     uint16_t dst = (op.value >> 10) & 0xFFF;
-    callStack.push_front((shdPc << 16) | (dst + (op.value & 0xFF)));
-    if (callStack.size() > 4) callStack.pop_back(); // 4-deep
+    callStack.push((shdPc << 16) | (dst + (op.value & 0xFF)));
     shdPc = dst;
 }
 
@@ -507,8 +800,7 @@ void GpuShaderInterp::shdCallu(ShaderCode &op) {
     // If a uniform bool is true, jump to an address and run a set number of opcodes
     if (!shdBools[(op.value >> 22) & 0xF]) return;
     uint16_t dst = (op.value >> 10) & 0xFFF;
-    callStack.push_front((shdPc << 16) | (dst + (op.value & 0xFF)));
-    if (callStack.size() > 4) callStack.pop_back(); // 4-deep
+    callStack.push((shdPc << 16) | (dst + (op.value & 0xFF)));
     shdPc = dst;
 }
 
@@ -516,8 +808,7 @@ void GpuShaderInterp::shdIfu(ShaderCode &op) {
     // If a uniform bool is true, run until an address then jump past it; otherwise jump to the address
     uint16_t dst = (op.value >> 10) & 0xFFF;
     if (shdBools[(op.value >> 22) & 0xF]) {
-        ifStack.push_front(((dst + (op.value & 0xFF)) << 16) | dst);
-        if (ifStack.size() > 8) ifStack.pop_back(); // 8-deep
+        ifStack.push(((dst + (op.value & 0xFF)) << 16) | dst);
     }
     else {
         shdPc = dst;
@@ -537,8 +828,7 @@ void GpuShaderInterp::shdIfc(ShaderCode &op) {
     // If true, run until an address then jump past it; otherwise jump to the address
     uint16_t dst = (op.value >> 10) & 0xFFF;
     if (cond) {
-        ifStack.push_front(((dst + (op.value & 0xFF)) << 16) | dst);
-        if (ifStack.size() > 8) ifStack.pop_back(); // 8-deep
+        ifStack.push(((dst + (op.value & 0xFF)) << 16) | dst);
     }
     else {
         shdPc = dst;
@@ -550,25 +840,24 @@ void GpuShaderInterp::shdLoop(ShaderCode &op) {
     uint8_t *ints = shdInts[(op.value >> 22) & 0x3];
     shdAddr[2] = ints[1]; // Loop counter
     uint16_t dst = ((op.value >> 10) + 1) & 0xFFF;
-    loopStack.push_front((ints[0] << 24) | ((shdPc & 0xFFF) << 12) | dst);
-    if (loopStack.size() > 4) loopStack.pop_back(); // 4-deep
+    loopStack.push((ints[0] << 24) | ((shdPc & 0xFFF) << 12) | dst);
 }
 
 void GpuShaderInterp::gshEmit(ShaderCode &op) {
     // Build a vertex from the current output and check the primitive bit
-    buildVertex(gshBuffer[emitParam >> 2]);
+    buildVertex(gshBuffer[emitParam >> 2], shdOut);
     if (~emitParam & BIT(1)) return;
 
     // Submit a triangle from the geometry buffer based on the winding bit
     if (emitParam & BIT(0)) {
-        gpuRender.submitVertex(gshBuffer[2]);
-        gpuRender.submitVertex(gshBuffer[1]);
-        gpuRender.submitVertex(gshBuffer[0]);
+        submitVtx(gshBuffer[2]);
+        submitVtx(gshBuffer[1]);
+        submitVtx(gshBuffer[0]);
     }
     else {
-        gpuRender.submitVertex(gshBuffer[0]);
-        gpuRender.submitVertex(gshBuffer[1]);
-        gpuRender.submitVertex(gshBuffer[2]);
+        submitVtx(gshBuffer[0]);
+        submitVtx(gshBuffer[1]);
+        submitVtx(gshBuffer[2]);
     }
 }
 
@@ -597,6 +886,17 @@ void GpuShaderInterp::shdJmpu(ShaderCode &op) {
     shdPc = (op.value >> 10) & 0xFFF;
 }
 
+void GpuShaderInterp::shdIf(ShaderCode &op) {
+    // Run until an address then jump past it, for an if resolved to true ahead of time
+    uint16_t dst = (op.value >> 10) & 0xFFF;
+    ifStack.push(((dst + (op.value & 0xFF)) << 16) | dst);
+}
+
+void GpuShaderInterp::shdJmp(ShaderCode &op) {
+    // Jump to an address, for a branch resolved to true ahead of time
+    shdPc = (op.value >> 10) & 0xFFF;
+}
+
 void GpuShaderInterp::shdCmp(ShaderCode &op) {
     // Set the X/Y condition values by comparing X/Y of two source registers
     float *src1 = getSrc<true>(op, 0);
@@ -645,8 +945,10 @@ void GpuShaderInterp::gshUnk(ShaderCode &op) {
 }
 
 void GpuShaderInterp::setOutMap(uint8_t (*map)[2]) {
-    // Set the map of shader outputs to fixed semantics
+    // Set the map of shader outputs to fixed semantics, and recompile the shaders if it changed
+    if (!memcmp(outMap, map, sizeof(outMap))) return;
     memcpy(outMap, map, sizeof(outMap));
+    vshDirty = gshDirty = true;
 }
 
 void GpuShaderInterp::setGshInMap(uint8_t *map) {
@@ -654,12 +956,32 @@ void GpuShaderInterp::setGshInMap(uint8_t *map) {
     memcpy(gshInMap, map, sizeof(gshInMap));
 }
 
+void GpuShaderInterp::setGshInCount(uint8_t count) {
+    // Set the number of vertex shader outputs passed to the geometry shader, which decides the live ones
+    if (gshInCount == count) return;
+    gshInCount = count;
+    vshDirty = true;
+}
+
+void GpuShaderInterp::setVshCode(int i, uint32_t value) {
+    // Cache a vertex shader opcode and mark the shader for recompiling
+    cacheCode(vshCode[i], value, false);
+    vshDirty = true;
+}
+
 void GpuShaderInterp::setVshEntry(uint16_t entry, uint16_t end) {
     // Set the vertex shader entry and end points
     vshEntry = entry;
     vshEnd = end;
 }
 
+void GpuShaderInterp::setVshBool(int i, bool value) {
+    // Set a vertex shader boolean and mark the shader for recompiling if it changed
+    if (vshBools[i] == value) return;
+    vshBools[i] = value;
+    vshDirty = true;
+}
+
 void GpuShaderInterp::setVshInts(int i, uint8_t int0, uint8_t int1, uint8_t int2) {
     // Set a group of 3 vertex shader integers
     vshInts[i][0] = int0;
@@ -672,12 +994,25 @@ void GpuShaderInterp::setVshFloats(int i, float *floats) {
     memcpy(vshFloats[i], floats, 4 * sizeof(float));
 }
 
+void GpuShaderInterp::setGshCode(int i, uint32_t value) {
+    // Cache a geometry shader opcode and mark the shader for recompiling
+    cacheCode(gshCode[i], value, true);
+    gshDirty = true;
+}
+
 void GpuShaderInterp::setGshEntry(uint16_t entry, uint16_t end) {
     // Set the geometry shader entry and end points
     gshEntry = entry;
     gshEnd = end;
 }
 
+void GpuShaderInterp::setGshBool(int i, bool value) {
+    // Set a geometry shader boolean and mark the shader for recompiling if it changed
+    if (gshBools[i] == value) return;
+    gshBools[i] = value;
+    gshDirty = true;
+}
+
 void GpuShaderInterp::setGshInts(int i, uint8_t int0, uint8_t int1, uint8_t int2) {
     // Set a group of 3 geometry shader integers
     gshInts[i][0] = int0;
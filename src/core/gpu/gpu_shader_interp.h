@@ -20,7 +20,7 @@
 #pragma once
 
 #include <cstdint>
-#include <deque>
+#include <vector>
 
 class GpuRender;
 
@@ -32,51 +32,83 @@ struct SoftVertex {
 };
 
 struct VertexCache {
-    SoftVertex vtx;
+    float out[16][4];
     uint32_t tag;
+    uint16_t idx;
 };
 
 struct SourceDesc {
     uint8_t map[4];
     bool negate;
+    bool direct;
 };
 
 struct ShaderDesc {
     SourceDesc src[3];
     bool dstMask[4];
+    bool fullMask;
+};
+
+template <int size> struct FlowStack {
+    uint32_t entries[size];
+    uint8_t top = 0;
+    uint8_t count = 0;
+
+    bool empty() { return !count; }
+    uint32_t &front() { return entries[top]; }
+    void clear() { count = 0; }
+    void pop() { top = (top + 1) & (size - 1), count--; }
+
+    void push(uint32_t value) {
+        // Push to the front, overwriting the oldest entry if the stack is full
+        entries[top = (top - 1) & (size - 1)] = value;
+        if (count < size) count++;
+    }
 };
 
 struct ShaderCode {
     void (GpuShaderInterp::*instr)(ShaderCode&);
+    void (GpuShaderInterp::*bat)(ShaderCode&);
     ShaderDesc *desc;
     float *dst;
     uint8_t src[3];
+    uint8_t dstReg;
     uint8_t idx;
     uint32_t value;
 };
 
 class GpuShaderInterp {
 public:
+    uint32_t vtxHits = 0;
+    uint32_t vtxMisses = 0;
+    uint64_t instrCount = 0;
+    uint64_t shadeTime = 0;
+    std::vector<SoftVertex> vtxBuffer;
+
     GpuShaderInterp(GpuRender &gpuRender);
+    void syncVsh(GpuShaderInterp &src);
+    void setBuffered(bool buffered) { this->buffered = buffered; }
 
-    void startList();
+    void startList(bool indexed);
     void processVtx(float (*input)[4], uint32_t idx = -1);
+    void queueVtx(float (*input)[4], uint32_t idx);
+    void flushVtxs();
 
     void setOutMap(uint8_t (*map)[2]);
     void setGshInMap(uint8_t *map);
-    void setGshInCount(uint8_t count) { gshInCount = count; }
+    void setGshInCount(uint8_t count);
 
-    void setVshCode(int i, uint32_t value) { cacheCode(vshCode[i], value, false); }
+    void setVshCode(int i, uint32_t value);
     void setVshDesc(int i, uint32_t value) { cacheDesc(vshDesc[i], value); }
     void setVshEntry(uint16_t entry, uint16_t end);
-    void setVshBool(int i, bool value) { vshBools[i] = value; }
+    void setVshBool(int i, bool value);
     void setVshInts(int i, uint8_t int0, uint8_t int1, uint8_t int2);
     void setVshFloats(int i, float *floats);
 
-    void setGshCode(int i, uint32_t value) { cacheCode(gshCode[i], value, true); }
+    void setGshCode(int i, uint32_t value);
     void setGshDesc(int i, uint32_t value) { cacheDesc(gshDesc[i], value); }
     void setGshEntry(uint16_t entry, uint16_t end);
-    void setGshBool(int i, bool value) { gshBools[i] = value; }
+    void setGshBool(int i, bool value);
     void setGshInts(int i, uint8_t int0, uint8_t int1, uint8_t int2);
     void setGshFloats(int i, float *floats);
 
@@ -85,9 +117,13 @@ private:
 
     static void (GpuShaderInterp::*vshInstrs[0x40])(ShaderCode&);
     static void (GpuShaderInterp::*gshInstrs[0x40])(ShaderCode&);
+    static void (GpuShaderInterp::*batInstrs[0x40])(ShaderCode&);
 
-    VertexCache vtxCache[0x101] = {};
+    VertexCache vtxCache[0x100][4] = {};
+    uint8_t vtxNext[0x100] = {};
     uint32_t vtxTag = 1;
+    bool cacheEnable = false;
+    bool buffered = false;
 
     float **srcRegs;
     float *dstRegs[0x20];
@@ -101,13 +137,28 @@ private:
     uint16_t shdPc;
     uint16_t shdStop;
 
-    std::deque<uint32_t> loopStack;
-    std::deque<uint32_t> ifStack;
-    std::deque<uint32_t> callStack;
+    FlowStack<4> loopStack;
+    FlowStack<8> ifStack;
+    FlowStack<4> callStack;
     float getRegs[4][4];
     uint8_t getIdx = 0;
 
+    float batIn[16][4][4];
+    float batTmp[16][4][4];
+    float batOut[16][4][4];
+    int16_t batAddr[2][4];
+    bool batCond[2][4];
+    bool batSplit = false;
+
+    SoftVertex batVtx[16];
+    uint32_t batIdx[16];
+    int8_t batLane[16];
+    uint8_t batCount = 0;
+    uint8_t batLanes = 0;
+
     float gshInput[16][4] = {};
+    std::vector<float> gshQueue;
+    uint32_t gshCount = 0;
     SoftVertex gshBuffer[4] = {};
     uint8_t gshInTotal = 0;
     uint8_t emitParam = 0;
@@ -118,6 +169,12 @@ private:
 
     ShaderCode vshCode[0x200] = {};
     ShaderDesc vshDesc[0x80] = {};
+    bool vshFlow[0x200] = {};
+    bool vshDirty = false;
+    uint8_t vshOutEnd = 16;
+    uint8_t vshTmpEnd = 16;
+    uint32_t vshVersion = 0;
+    uint32_t syncVersion = -1;
     uint16_t vshEntry = 0;
     uint16_t vshEnd = 0;
     bool vshBools[16] = {};
@@ -127,6 +184,10 @@ private:
 
     ShaderCode gshCode[0x1000] = {};
     ShaderDesc gshDesc[0x80] = {};
+    bool gshFlow[0x1000] = {};
+    bool gshDirty = false;
+    uint8_t gshOutEnd = 16;
+    uint8_t gshTmpEnd = 16;
     uint16_t gshEntry = 0;
     uint16_t gshEnd = 0;
     bool gshBools[16] = {};
@@ -136,9 +197,18 @@ private:
 
     void cacheCode(ShaderCode &code, uint32_t value, bool geo);
     void cacheDesc(ShaderDesc &desc, uint32_t value);
+    VertexCache *findVtx(uint32_t idx);
+    VertexCache *addVtx(uint32_t idx);
+    void submitVtx(SoftVertex &vertex);
 
+    template <bool geo> void compileShader();
     template <bool geo> void runShader();
-    void buildVertex(SoftVertex &vertex);
+    template <bool geo> void updateFlow(uint16_t cmpPc);
+    void buildVertex(SoftVertex &vertex, float (*out)[4]);
+    void outputVtx(uint8_t i, float (*out)[4]);
+    void shadeVtxs();
+    void runGeometry();
+    bool runBatch();
 
     static float mult(float a, float b);
     template <bool relative> float *getSrc(ShaderCode &op, int i);
@@ -177,9 +247,38 @@ private:
     void gshSetemit(ShaderCode &op);
     void shdJmpc(ShaderCode &op);
     void shdJmpu(ShaderCode &op);
+    void shdIf(ShaderCode &op);
+    void shdJmp(ShaderCode &op);
     void shdCmp(ShaderCode &op);
     void shdMadi(ShaderCode &op);
     void shdMad(ShaderCode &op);
     void vshUnk(ShaderCode &op);
     void gshUnk(ShaderCode &op);
+
+    template <bool relative> void getBatSrc(ShaderCode &op, int i, float (*value)[4]);
+    void setBatDst(ShaderCode &op, float (*value)[4]);
+
+    void batAdd(ShaderCode &op);
+    void batDp3(ShaderCode &op);
+    void batDp4(ShaderCode &op);
+    void batDph(ShaderCode &op);
+    void batEx2(ShaderCode &op);
+    void batLg2(ShaderCode &op);
+    void batMul(ShaderCode &op);
+    void batSge(ShaderCode &op);
+    void batSlt(ShaderCode &op);
+    void batFlr(ShaderCode &op);
+    void batMax(ShaderCode &op);
+    void batMin(ShaderCode &op);
+    void batRcp(ShaderCode &op);
+    void batRsq(ShaderCode &op);
+    void batMova(ShaderCode &op);
+    void batMov(ShaderCode &op);
+    void batDphi(ShaderCode &op);
+    void batSgei(ShaderCode &op);
+    void batSlti(ShaderCode &op);
+    void batFlow(ShaderCode &op);
+    void batCmp(ShaderCode &op);
+    void batMadi(ShaderCode &op);
+    void batMad(ShaderCode &op);
 };
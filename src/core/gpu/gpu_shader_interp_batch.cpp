@@ -0,0 +1,389 @@
+/*
+    Copyright 2023-2025 Hydr8gon
+
+    This file is part of 3Beans.
+
+    3Beans is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    3Beans is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with 3Beans. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstring>
+
+#include "../core.h"
+#include "gpu_render.h"
+
+// Lookup table for batched vertex shader instructions
+void (GpuShaderInterp::*GpuShaderInterp::batInstrs[])(ShaderCode&) {
+    &GpuShaderInterp::batAdd, &GpuShaderInterp::batDp3, &GpuShaderInterp::batDp4, &GpuShaderInterp::batDph, // 0x00-0x03
+    &GpuShaderInterp::vshUnk, &GpuShaderInterp::batEx2, &GpuShaderInterp::batLg2, &GpuShaderInterp::vshUnk, // 0x04-0x07
+    &GpuShaderInterp::batMul, &GpuShaderInterp::batSge, &GpuShaderInterp::batSlt, &GpuShaderInterp::batFlr, // 0x08-0x0B
+    &GpuShaderInterp::batMax, &GpuShaderInterp::batMin, &GpuShaderInterp::batRcp, &GpuShaderInterp::batRsq, // 0x0C-0x0F
+    &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, &GpuShaderInterp::batMova, &GpuShaderInterp::batMov, // 0x10-0x13
+    &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, // 0x14-0x17
+    &GpuShaderInterp::batDphi, &GpuShaderInterp::vshUnk, &GpuShaderInterp::batSgei, &GpuShaderInterp::batSlti, // 0x18-0x1B
+    &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, // 0x1C-0x1F
+    &GpuShaderInterp::shdBreak, &GpuShaderInterp::shdNop, &GpuShaderInterp::shdEnd, &GpuShaderInterp::batFlow, // 0x20-0x23
+    &GpuShaderInterp::shdCall, &GpuShaderInterp::batFlow, &GpuShaderInterp::shdCallu, &GpuShaderInterp::shdIfu, // 0x24-0x27
+    &GpuShaderInterp::batFlow, &GpuShaderInterp::shdLoop, &GpuShaderInterp::vshUnk, &GpuShaderInterp::vshUnk, // 0x28-0x2B
+    &GpuShaderInterp::batFlow, &GpuShaderInterp::shdJmpu, &GpuShaderInterp::batCmp, &GpuShaderInterp::batCmp, // 0x2C-0x2F
+    &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, // 0x30-0x33
+    &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, &GpuShaderInterp::batMadi, // 0x34-0x37
+    &GpuShaderInterp::batMad, &GpuShaderInterp::batMad, &GpuShaderInterp::batMad, &GpuShaderInterp::batMad, // 0x38-0x3B
+    &GpuShaderInterp::batMad, &GpuShaderInterp::batMad, &GpuShaderInterp::batMad, &GpuShaderInterp::batMad // 0x3C-0x3F
+};
+
+bool GpuShaderInterp::runBatch() {
+    // Recompile the vertex shader if its code or configuration changed since the last run
+    if (vshDirty) compileShader<false>();
+
+    // Set the initial PC and stop address for the vertex shader
+    shdPc = vshEntry;
+    shdStop = vshEnd;
+
+    // Reset the general and per-lane shader state, limited to registers the shader can use
+    memset(batTmp, 0, vshTmpEnd * sizeof(batTmp[0]));
+    memset(batOut, 0, vshOutEnd * sizeof(batOut[0]));
+    memset(batAddr, 0, sizeof(batAddr));
+    memset(batCond, 0, sizeof(batCond));
+    memset(shdAddr, 0, sizeof(shdAddr));
+    memset(shdCond, 0, sizeof(shdCond));
+    loopStack.clear();
+    ifStack.clear();
+    callStack.clear();
+    batSplit = false;
+
+    // Execute the vertex shader on all lanes in lockstep until completion or divergence
+    uint32_t count = 0;
+    while (shdPc != shdStop) {
+        ShaderCode *op = &vshCode[shdPc & 0x1FF];
+        uint16_t cmpPc = ++shdPc;
+        (this->*op->bat)(*op);
+        if (vshFlow[cmpPc & 0x1FF]) updateFlow<false>(cmpPc);
+        count++;
+    }
+
+    // Count instructions for each vertex if the batch didn't have to be rerun serially
+    if (!batSplit) instrCount += count * batLanes;
+    return !batSplit;
+}
+
+template <bool relative> void GpuShaderInterp::getBatSrc(ShaderCode &op, int i, float (*value)[4]) {
+    // Get parameters for the indexed source
+    SourceDesc &desc = op.desc->src[i];
+    uint8_t src = op.src[i];
+
+    // Swizzle temporary or input registers, which are stored per lane
+    if (src < 0x20) {
+        float (*reg)[4] = (src < 0x10) ? batIn[src] : batTmp[src - 0x10];
+        for (int j = 0; j < 4; j++)
+            for (int l = 0; l < 4; l++)
+                value[j][l] = desc.negate ? -reg[desc.map[j]][l] : reg[desc.map[j]][l];
+        return;
+    }
+
+    // Swizzle uniform registers, applying per-lane relative addressing if enabled
+    for (int l = 0; l < 4; l++) {
+        uint8_t reg = src;
+        if (relative && op.idx) {
+            reg += (op.idx == 3) ? shdAddr[2] : batAddr[op.idx - 1][l];
+            if (reg < 0x20 || reg >= 0x80) {
+                value[0][l] = value[1][l] = value[2][l] = value[3][l] = 0.0f;
+                continue;
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            float f = vshFloats[reg - 0x20][desc.map[j]];
+            value[j][l] = desc.negate ? -f : f;
+        }
+    }
+}
+
+void GpuShaderInterp::setBatDst(ShaderCode &op, float (*value)[4]) {
+    // Set a destination register for all lanes using the descriptor mask
+    float (*dst)[4] = (op.dstReg < 0x10) ? batOut[op.dstReg] : batTmp[op.dstReg - 0x10];
+    for (int j = 0; j < 4; j++)
+        if (op.desc->dstMask[j])
+            memcpy(dst[j], value[j], 4 * sizeof(float));
+}
+
+void GpuShaderInterp::batAdd(ShaderCode &op) {
+    // Add each component of two source registers with each other
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = src1[j][l] + src2[j][l];
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batDp3(ShaderCode &op) {
+    // Calculate the dot product of two 3-component source registers
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int l = 0; l < 4; l++) {
+        src1[0][l] = mult(src1[0][l], src2[0][l]) + mult(src1[1][l], src2[1][l]) + mult(src1[2][l], src2[2][l]);
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l];
+    }
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batDp4(ShaderCode &op) {
+    // Calculate the dot product of two 4-component source registers
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int l = 0; l < 4; l++) {
+        src1[0][l] = mult(src1[0][l], src2[0][l]) + mult(src1[1][l], src2[1][l]) +
+            mult(src1[2][l], src2[2][l]) + mult(src1[3][l], src2[3][l]);
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l];
+    }
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batDph(ShaderCode &op) {
+    // Calculate the dot product of a 3-component and a 4-component source register
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int l = 0; l < 4; l++) {
+        src1[0][l] = mult(src1[0][l], src2[0][l]) + mult(src1[1][l], src2[1][l]) +
+            mult(src1[2][l], src2[2][l]) + src2[3][l];
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l];
+    }
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batEx2(ShaderCode &op) {
+    // Calculate the base-2 exponent of a source register's first component
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int l = 0; l < 4; l++)
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l] = exp2f(src1[0][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batLg2(ShaderCode &op) {
+    // Calculate the base-2 logarithm of a source register's first component
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int l = 0; l < 4; l++)
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l] = log2f(src1[0][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batMul(ShaderCode &op) {
+    // Multiply each component of two source registers with each other
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = mult(src1[j][l], src2[j][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batSge(ShaderCode &op) {
+    // Output 1 or 0 based on if source 1's components are greater or equal to source 2's
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = (src1[j][l] >= src2[j][l]) ? 1.0f : 0.0f;
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batSlt(ShaderCode &op) {
+    // Output 1 or 0 based on if source 1's components are less than source 2's
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = (src1[j][l] < src2[j][l]) ? 1.0f : 0.0f;
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batFlr(ShaderCode &op) {
+    // Set the destination components to the floor of the source components
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = floorf(src1[j][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batMax(ShaderCode &op) {
+    // Set the destination components to the maximum of two source components
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = std::max(src1[j][l], src2[j][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batMin(ShaderCode &op) {
+    // Set the destination components to the minimum of two source components
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = std::min(src1[j][l], src2[j][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batRcp(ShaderCode &op) {
+    // Calculate the reciprocal of a source register's first component
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int l = 0; l < 4; l++)
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l] = 1.0f / src1[0][l];
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batRsq(ShaderCode &op) {
+    // Calculate the reverse square root of a source register's first component
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int l = 0; l < 4; l++)
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l] = 1.0f / sqrtf(src1[0][l]);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batMova(ShaderCode &op) {
+    // Move values from a source register to the X/Y address registers of each lane
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    for (int l = 0; l < 4; l++) {
+        if (op.desc->dstMask[0]) batAddr[0][l] = src1[0][l];
+        if (op.desc->dstMask[1]) batAddr[1][l] = src1[1][l];
+    }
+}
+
+void GpuShaderInterp::batMov(ShaderCode &op) {
+    // Move a value from a source register to a destination register
+    float src1[4][4];
+    getBatSrc<true>(op, 0, src1);
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batDphi(ShaderCode &op) {
+    // Calculate the dot product of a 3-component and a 4-component source register (alternate)
+    float src1[4][4], src2[4][4];
+    getBatSrc<false>(op, 0, src1);
+    getBatSrc<true>(op, 1, src2);
+    for (int l = 0; l < 4; l++) {
+        src1[0][l] = mult(src1[0][l], src2[0][l]) + mult(src1[1][l], src2[1][l]) +
+            mult(src1[2][l], src2[2][l]) + src2[3][l];
+        src1[3][l] = src1[2][l] = src1[1][l] = src1[0][l];
+    }
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batSgei(ShaderCode &op) {
+    // Output 1 or 0 based on if source 1's components are greater or equal to source 2's (alternate)
+    float src1[4][4], src2[4][4];
+    getBatSrc<false>(op, 0, src1);
+    getBatSrc<true>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = (src1[j][l] >= src2[j][l]) ? 1.0f : 0.0f;
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batSlti(ShaderCode &op) {
+    // Output 1 or 0 based on if source 1's components are less than source 2's (alternate)
+    float src1[4][4], src2[4][4];
+    getBatSrc<false>(op, 0, src1);
+    getBatSrc<true>(op, 1, src2);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = (src1[j][l] < src2[j][l]) ? 1.0f : 0.0f;
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batFlow(ShaderCode &op) {
+    // Evaluate the X/Y condition values of each lane using reference values
+    bool cond[4], refX = (op.value & BIT(25)), refY = (op.value & BIT(24));
+    for (int l = 0; l < 4; l++) {
+        switch ((op.value >> 22) & 0x3) {
+            case 0x0: cond[l] = (batCond[0][l] == refX || batCond[1][l] == refY); break; // OR
+            case 0x1: cond[l] = (batCond[0][l] == refX && batCond[1][l] == refY); break; // AND
+            case 0x2: cond[l] = (batCond[0][l] == refX); break; // X
+            default: cond[l] = (batCond[1][l] == refY); break; // Y
+        }
+    }
+
+    // Stop the batch if lanes would take different paths so they can be run separately
+    if (cond[1] != cond[0] || cond[2] != cond[0] || cond[3] != cond[0]) {
+        batSplit = true;
+        shdPc = shdStop;
+        return;
+    }
+
+    // Run the conditional opcode normally using the first lane's condition values
+    shdCond[0] = batCond[0][0];
+    shdCond[1] = batCond[1][0];
+    (this->*vshInstrs[op.value >> 26])(op);
+}
+
+void GpuShaderInterp::batCmp(ShaderCode &op) {
+    // Set the X/Y condition values of each lane by comparing X/Y of two source registers
+    float src1[4][4], src2[4][4];
+    getBatSrc<true>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    for (int i = 0; i < 2; i++) {
+        for (int l = 0; l < 4; l++) {
+            switch ((op.value >> (24 - i * 3)) & 0x7) {
+                case 0x0: batCond[i][l] = (src1[i][l] == src2[i][l]); continue; // EQ
+                case 0x1: batCond[i][l] = (src1[i][l] != src2[i][l]); continue; // NE
+                case 0x2: batCond[i][l] = (src1[i][l] < src2[i][l]); continue; // LT
+                case 0x3: batCond[i][l] = (src1[i][l] <= src2[i][l]); continue; // LE
+                case 0x4: batCond[i][l] = (src1[i][l] > src2[i][l]); continue; // GT
+                case 0x5: batCond[i][l] = (src1[i][l] >= src2[i][l]); continue; // GE
+                default: batCond[i][l] = true; continue;
+            }
+        }
+    }
+}
+
+void GpuShaderInterp::batMadi(ShaderCode &op) {
+    // Multiply each component of two source registers and add a third one (alternate)
+    float src1[4][4], src2[4][4], src3[4][4];
+    getBatSrc<false>(op, 0, src1);
+    getBatSrc<false>(op, 1, src2);
+    getBatSrc<true>(op, 2, src3);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = mult(src1[j][l], src2[j][l]) + src3[j][l];
+    setBatDst(op, src1);
+}
+
+void GpuShaderInterp::batMad(ShaderCode &op) {
+    // Multiply each component of two source registers and add a third one
+    float src1[4][4], src2[4][4], src3[4][4];
+    getBatSrc<false>(op, 0, src1);
+    getBatSrc<true>(op, 1, src2);
+    getBatSrc<false>(op, 2, src3);
+    for (int j = 0; j < 4; j++)
+        for (int l = 0; l < 4; l++)
+            src1[j][l] = mult(src1[j][l], src2[j][l]) + src3[j][l];
+    setBatDst(op, src1);
+}
@@ -0,0 +1,150 @@
+/*
+    Copyright 2023-2025 Hydr8gon
+
+    This file is part of 3Beans.
+
+    3Beans is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    3Beans is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with 3Beans. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "../core.h"
+#include "gpu_render.h"
+#include "gpu_trace.h"
+
+GpuTrace::~GpuTrace() {
+    // Finish any pending command and close the file
+    if (!file) return;
+    if (writing) flushCmds();
+    fclose(file);
+}
+
+bool GpuTrace::openWrite(std::string path) {
+    // Create a trace file and write its header
+    if (!(file = fopen(path.c_str(), "wb"))) return false;
+    uint32_t header[2] = { TRACE_MAGIC, TRACE_VERSION };
+    fwrite(header, sizeof(uint32_t), 2, file);
+    return (writing = true);
+}
+
+bool GpuTrace::openRead(std::string path) {
+    // Open a trace file and make sure its header matches
+    if (!(file = fopen(path.c_str(), "rb"))) return false;
+    uint32_t header[2];
+    return readData(header, sizeof(header)) && header[0] == TRACE_MAGIC && header[1] == TRACE_VERSION;
+}
+
+void GpuTrace::writeCmd(uint16_t cmd, uint32_t mask, uint32_t value) {
+    // Convert the mask back to the byte enables of a command header
+    uint32_t enables = 0;
+    for (int i = 0; i < 4; i++)
+        if (mask & (0xFF << (i * 8))) enables |= BIT(i);
+
+    // Append to the pending command if it has the same mask and this continues its fixed or increasing ID
+    if (cmdCount && cmdCount < 0x100 && ((cmdHeader >> 16) & 0xF) == enables) {
+        uint16_t base = (cmdHeader & 0x3FF);
+        bool fixed = (cmd == base && (cmdCount == 1 || !(cmdHeader & BIT(31))));
+        bool incr = (cmd == ((base + cmdCount) & 0x3FF) && (cmdCount == 1 || (cmdHeader & BIT(31))));
+        if (fixed || incr) {
+            if (incr) cmdHeader |= BIT(31);
+            cmdBuf[cmdCount++] = value;
+            return;
+        }
+    }
+
+    // Start a new pending command otherwise
+    flushCmds();
+    cmdHeader = (enables << 16) | cmd;
+    cmdBuf[0] = value;
+    cmdCount = 1;
+}
+
+void GpuTrace::flushCmds() {
+    // Write the pending command using the GPU's header format, with the parameter count filled in
+    if (!cmdCount) return;
+    uint32_t header[2] = { TRACE_CMD, cmdHeader | ((cmdCount - 1) << 20) };
+    fwrite(header, sizeof(uint32_t), 2, file);
+    fwrite(cmdBuf, sizeof(uint32_t), cmdCount, file);
+    cmdCount = 0;
+}
+
+void GpuTrace::writeRecord(TraceType type, const void *data, uint32_t size) {
+    // Write a record after any pending command so everything stays in execution order
+    flushCmds();
+    uint32_t value = type;
+    fwrite(&value, sizeof(uint32_t), 1, file);
+    writeData(data, size);
+    if (type == TRACE_FRAME) frames++;
+}
+
+void GpuTrace::writeData(const void *data, uint32_t size) {
+    // Write raw data as part of the current record
+    if (size) fwrite(data, sizeof(uint8_t), size, file);
+}
+
+void GpuTrace::writeMemory(uint32_t address, uint32_t size, bool once) {
+    // Look up the last recorded contents of a range, skipping it if only the first copy is needed
+    if (!size) return;
+    TraceBlock block = { address, size, 0 };
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), block);
+    bool found = (it != blocks.end() && it->addr == address && it->size == size);
+    if (found && once) return;
+
+    // Get the contents of the range, staging them if they aren't contiguous
+    const uint8_t *data = core->memory.getHostPtr(address, size, false);
+    if (!data) {
+        stage.resize(size);
+        for (uint32_t i = 0; i < size; i++)
+            stage[i] = core->memory.read<uint8_t>(ARM11, address + i);
+        data = &stage[0];
+    }
+
+    // Skip the range if it hasn't changed since it was last recorded
+    block.hash = GpuRender::hashData(data, size);
+    if (found && it->hash == block.hash) return;
+    if (found) it->hash = block.hash;
+    else blocks.insert(it, block);
+
+    // Record the contents so a replay can restore them before the commands that use them
+    uint32_t header[2] = { address, size };
+    writeRecord(TRACE_MEM, header, sizeof(header));
+    writeData(data, size);
+}
+
+bool GpuTrace::readType(uint32_t &type) {
+    // Read the type of the next record, counting frames as they end
+    if (!readData(&type, sizeof(type))) return false;
+    if (type == TRACE_FRAME) frames++;
+    return true;
+}
+
+bool GpuTrace::readData(void *data, uint32_t size) {
+    // Read raw data from the current record
+    return !size || fread(data, sizeof(uint8_t), size, file) == size;
+}
+
+bool GpuTrace::readMemory() {
+    // Read a recorded memory range directly into memory if possible
+    uint32_t header[2];
+    if (!readData(header, sizeof(header))) return false;
+    if (uint8_t *data = core->memory.getHostPtr(header[0], header[1], true))
+        return readData(data, header[1]);
+
+    // Stage the range and write it through memory accessors otherwise
+    stage.resize(header[1]);
+    if (!readData(&stage[0], header[1])) return false;
+    for (uint32_t i = 0; i < header[1]; i++)
+        core->memory.write<uint8_t>(ARM11, header[0] + i, stage[i]);
+    return true;
+}
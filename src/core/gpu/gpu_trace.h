@@ -0,0 +1,82 @@
+/*
+    Copyright 2023-2025 Hydr8gon
+
+    This file is part of 3Beans.
+
+    3Beans is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    3Beans is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with 3Beans. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define TRACE_MAGIC 0x52544233 // "3BTR"
+#define TRACE_VERSION 1
+
+class Core;
+
+enum TraceType {
+    TRACE_STATE,
+    TRACE_CMD,
+    TRACE_FILL,
+    TRACE_COPY,
+    TRACE_MEM,
+    TRACE_FRAME
+};
+
+struct TraceBlock {
+    uint32_t addr;
+    uint32_t size;
+    uint64_t hash;
+
+    bool operator<(const TraceBlock &block) const {
+        return (addr != block.addr) ? (addr < block.addr) : (size < block.size);
+    }
+};
+
+class GpuTrace {
+public:
+    uint32_t frames = 0;
+
+    GpuTrace(Core *core): core(core) {}
+    ~GpuTrace();
+
+    bool openWrite(std::string path);
+    bool openRead(std::string path);
+
+    void writeCmd(uint16_t cmd, uint32_t mask, uint32_t value);
+    void writeRecord(TraceType type, const void *data, uint32_t size);
+    void writeData(const void *data, uint32_t size);
+    void writeMemory(uint32_t address, uint32_t size, bool once);
+
+    bool readType(uint32_t &type);
+    bool readData(void *data, uint32_t size);
+    bool readMemory();
+
+private:
+    Core *core;
+    FILE *file = nullptr;
+    bool writing = false;
+    std::vector<TraceBlock> blocks;
+    std::vector<uint8_t> stage;
+
+    uint32_t cmdBuf[0x100];
+    uint32_t cmdHeader = 0;
+    uint16_t cmdCount = 0;
+
+    void flushCmds();
+};
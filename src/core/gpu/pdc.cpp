@@ -20,85 +20,116 @@
 #include <cstring>
 #include "../core.h"
 
+// Lookup tables for expanding 4, 5, and 6-bit color components to 8-bit
+const uint8_t Pdc::expand4[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF };
+const uint8_t Pdc::expand5[] = {
+    0x00, 0x08, 0x10, 0x18, 0x20, 0x29, 0x31, 0x39, 0x41, 0x4A, 0x52, 0x5A, 0x62, 0x6A, 0x73, 0x7B,
+    0x83, 0x8B, 0x94, 0x9C, 0xA4, 0xAC, 0xB4, 0xBD, 0xC5, 0xCD, 0xD5, 0xDE, 0xE6, 0xEE, 0xF6, 0xFF
+};
+const uint8_t Pdc::expand6[] = {
+    0x00, 0x04, 0x08, 0x0C, 0x10, 0x14, 0x18, 0x1C, 0x20, 0x24, 0x28, 0x2C, 0x30, 0x34, 0x38, 0x3C,
+    0x40, 0x44, 0x48, 0x4C, 0x50, 0x55, 0x59, 0x5D, 0x61, 0x65, 0x69, 0x6D, 0x71, 0x75, 0x79, 0x7D,
+    0x81, 0x85, 0x89, 0x8D, 0x91, 0x95, 0x99, 0x9D, 0xA1, 0xA5, 0xAA, 0xAE, 0xB2, 0xB6, 0xBA, 0xBE,
+    0xC2, 0xC6, 0xCA, 0xCE, 0xD2, 0xD6, 0xDA, 0xDE, 0xE2, 0xE6, 0xEA, 0xEE, 0xF2, 0xF6, 0xFA, 0xFF
+};
+
 uint32_t *Pdc::getFrame() {
-    // Get the next frame in the queue when one is ready
+    // Get the next frame in the queue when one is ready, releasing the previous one back to the pool
     if (!ready.load()) return nullptr;
     mutex.lock();
-    uint32_t *fb = buffers.front();
+    held = buffers.front();
     buffers.pop();
     ready.store(!buffers.empty());
     mutex.unlock();
-    return fb;
+    return held;
 }
 
-void Pdc::drawScreen(int i, uint32_t *buffer) {
-    // Draw a screen's framebuffer in the selected format if enabled
-    if (~pdcInterruptType[i] & BIT(0)) return;
-    int width = (i ? 320 : 400);
-    switch (pdcFramebufFormat[i] & 0x7) {
-    case 0: // RGBA8
-        for (int y = 0; y < 240; y++) {
-            for (int x = 0; x < width; x++) {
-                uint32_t address = screenBases[i] + x * pdcFramebufStep[i] + (239 - y) * 4;
-                uint32_t color = core->memory.read<uint32_t>(ARM11A, address);
-                uint8_t r = (color >> 24) & 0xFF;
-                uint8_t g = (color >> 16) & 0xFF;
-                uint8_t b = (color >> 8) & 0xFF;
-                buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
+template <int fmt> void Pdc::drawPixels(uint32_t *buffer, const uint8_t *data, int width, uint32_t step) {
+    // Convert a rotated framebuffer one column at a time, expanding components with lookup tables
+    static const int bpp = (fmt == 0) ? 4 : (fmt == 1) ? 3 : 2;
+    for (int x = 0; x < width; x++) {
+        const uint8_t *column = &data[x * step + 239 * bpp];
+        for (int y = 0; y < 240; y++, column -= bpp) {
+            uint8_t r, g, b;
+            uint16_t color = (bpp == 2) ? U8TO16(column, 0) : 0;
+            switch (fmt) {
+            case 0: // RGBA8
+                r = column[3], g = column[2], b = column[1];
+                break;
+            case 1: // RGB8
+                r = column[2], g = column[1], b = column[0];
+                break;
+            case 2: // RGB565
+                r = expand5[(color >> 11) & 0x1F], g = expand6[(color >> 5) & 0x3F], b = expand5[color & 0x1F];
+                break;
+            case 3: // RGB5A1
+                r = expand5[(color >> 11) & 0x1F], g = expand5[(color >> 6) & 0x1F], b = expand5[(color >> 1) & 0x1F];
+                break;
+            default: // RGBA4
+                r = expand4[(color >> 12) & 0xF], g = expand4[(color >> 8) & 0xF], b = expand4[(color >> 4) & 0xF];
+                break;
             }
+            buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
         }
-        return;
+    }
+}
 
-    case 1: // RGB8
-        for (int y = 0; y < 240; y++) {
-            for (int x = 0; x < width; x++) {
-                uint32_t address = screenBases[i] + x * pdcFramebufStep[i] + (239 - y) * 3;
-                uint8_t r = core->memory.read<uint8_t>(ARM11, address + 2);
-                uint8_t g = core->memory.read<uint8_t>(ARM11, address + 1);
-                uint8_t b = core->memory.read<uint8_t>(ARM11, address + 0);
-                buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
-            }
-        }
-        return;
+bool Pdc::checkSkip() {
+    // Track how far behind real time the host is, ignoring long stalls like pausing
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float elapsed = std::chrono::duration<float>(now - lastFrameTime).count();
+    lastFrameTime = now;
+    frameDebt = std::max(0.0f, std::min(0.25f, frameDebt + elapsed - 1.0f / 60));
+
+    // Skip a fixed number of frames between presented ones, or up to 3 in a row when behind if automatic
+    bool skip;
+    switch (Settings::frameSkip) {
+        case 0: skip = false; break;
+        case 1: case 2: case 3: skip = (skipCount < Settings::frameSkip); break;
+        default: skip = (skipCount < 3 && frameDebt > 1.0f / 120); break;
+    }
+    skipCount = skip ? (skipCount + 1) : 0;
+    return skip;
+}
 
-    case 2: // RGB565
-        for (int y = 0; y < 240; y++) {
-            for (int x = 0; x < width; x++) {
-                uint32_t address = screenBases[i] + x * pdcFramebufStep[i] + (239 - y) * 2;
-                uint16_t color = core->memory.read<uint16_t>(ARM11, address);
-                uint8_t r = ((color >> 11) & 0x1F) * 255 / 31;
-                uint8_t g = ((color >> 5) & 0x3F) * 255 / 63;
-                uint8_t b = ((color >> 0) & 0x1F) * 255 / 31;
-                buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
-            }
-        }
-        return;
+const uint8_t *Pdc::getScreen(int i, uint32_t &size) {
+    // Skip disabled screens
+    size = 0;
+    if (~pdcInterruptType[i] & BIT(0))
+        return nullptr;
+
+    // Treat the screen as disabled if a bogus step would make its framebuffer unreasonably large
+    static const uint8_t sizes[] = { 4, 3, 2, 2, 2, 2, 2, 2 };
+    uint64_t total = uint64_t((i ? 320 : 400) - 1) * pdcFramebufStep[i] + 240 * sizes[pdcFramebufFormat[i] & 0x7];
+    if (total > MAX_SCREEN_SIZE)
+        return nullptr;
+
+    // Get a host pointer to the framebuffer, or stage it through memory accessors if not contiguous
+    size = total;
+    if (const uint8_t *data = core->memory.getHostPtr(screenBases[i], size, false))
+        return data;
+    stage[i].resize(size);
+    for (uint32_t j = 0; j < size; j++)
+        stage[i][j] = core->memory.read<uint8_t>(ARM11, screenBases[i] + j);
+    return &stage[i][0];
+}
 
-    case 3: // RGB5A1
-        for (int y = 0; y < 240; y++) {
-            for (int x = 0; x < width; x++) {
-                uint32_t address = screenBases[i] + x * pdcFramebufStep[i] + (239 - y) * 2;
-                uint16_t color = core->memory.read<uint16_t>(ARM11, address);
-                uint8_t r = ((color >> 11) & 0x1F) * 255 / 31;
-                uint8_t g = ((color >> 6) & 0x1F) * 255 / 31;
-                uint8_t b = ((color >> 1) & 0x1F) * 255 / 31;
-                buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
-            }
-        }
+void Pdc::drawScreen(int i, uint32_t *buffer, const uint8_t *data) {
+    // Clear the screen if disabled
+    int width = (i ? 320 : 400);
+    if (!data) {
+        for (int y = 0; y < 240; y++)
+            memset(&buffer[y * 400], 0, width * sizeof(uint32_t));
         return;
+    }
 
-    default: // RGBA4
-        for (int y = 0; y < 240; y++) {
-            for (int x = 0; x < width; x++) {
-                uint32_t address = screenBases[i] + x * pdcFramebufStep[i] + (239 - y) * 2;
-                uint16_t color = core->memory.read<uint16_t>(ARM11, address);
-                uint8_t r = ((color >> 12) & 0xF) * 255 / 15;
-                uint8_t g = ((color >> 8) & 0xF) * 255 / 15;
-                uint8_t b = ((color >> 4) & 0xF) * 255 / 15;
-                buffer[y * 400 + x] = (0xFF << 24) | (b << 16) | (g << 8) | r;
-            }
-        }
-        return;
+    // Draw a screen's framebuffer in the selected format
+    switch (pdcFramebufFormat[i] & 0x7) {
+        case 0: return drawPixels<0>(buffer, data, width, pdcFramebufStep[i]);
+        case 1: return drawPixels<1>(buffer, data, width, pdcFramebufStep[i]);
+        case 2: return drawPixels<2>(buffer, data, width, pdcFramebufStep[i]);
+        case 3: return drawPixels<3>(buffer, data, width, pdcFramebufStep[i]);
+        default: return drawPixels<4>(buffer, data, width, pdcFramebufStep[i]);
     }
 }
 
@@ -110,21 +141,58 @@ void Pdc::drawFrame() {
     if (((pdcInterruptType[1] >> 8) & 0x7) != 0x7)
         core->interrupts.sendInterrupt(ARM11, 0x2B);
 
-    // Update screen base addresses and sync the GPU thread if one changed
+    // Update screen base addresses, keeping the previous ones if the GPU thread is a frame behind
+    // This adds a frame of display latency with the threaded GPU, like triple buffering, but it's what lets
+    // the thread keep drawing while the CPU emulates the next frame instead of syncing at every V-blank
+    bool lagging = core->gpu.fenceFrame();
     for (int i = 0; i < 2; i++) {
         uint32_t base = (pdcFramebufSelAck[i] & BIT(0)) ? pdcFramebufLt1[i] : pdcFramebufLt0[i];
-        if (screenBases[i] != base) core->gpu.syncRender();
-        screenBases[i] = base;
+        screenBases[i] = lagging ? nextBases[i] : base;
+        nextBases[i] = base;
     }
 
+    // Decide if the next frame should be skipped, and don't present the finished one if it was
+    bool skip = lagging ? skipped[1] : skipped[0];
+    skipped[1] = skipped[0];
+    core->gpu.skipFrame(skipped[0] = checkSkip());
+    if (skip) return;
+
     // Allow up to 2 framebuffers to be queued
     if (buffers.size() == 2) return;
-    uint32_t *buffer = new uint32_t[400 * 480];
-    memset(buffer, 0, 400 * 480 * sizeof(uint32_t));
 
-    // Draw the top and bottom screens
-    drawScreen(0, &buffer[0]);
-    drawScreen(1, &buffer[240 * 400 + 40]);
+    // Compare the screen configurations and contents with the last queued frame
+    const uint8_t *data[2];
+    uint32_t sizes[2];
+    bool changed = false;
+    for (int i = 0; i < 2; i++) {
+        data[i] = getScreen(i, sizes[i]);
+        uint32_t config[] = { pdcInterruptType[i] & BIT(0), screenBases[i],
+            pdcFramebufFormat[i] & 0x7U, pdcFramebufStep[i] };
+        if (memcmp(config, lastConfig[i], sizeof(config)) || lastData[i].size() != sizes[i] ||
+                (sizes[i] && memcmp(data[i], &lastData[i][0], sizes[i]))) {
+            memcpy(lastConfig[i], config, sizeof(config));
+            lastData[i].assign(data[i], data[i] + sizes[i]);
+            changed = true;
+        }
+    }
+
+    // Skip drawing and queueing if nothing would differ, so frontends keep showing their last frame
+    if (!changed) return;
+
+    // Pick a framebuffer from the pool that isn't queued or held by the frontend
+    mutex.lock();
+    uint32_t *buffer = frames[0];
+    for (int i = 0; buffer == held || (!buffers.empty() && buffer == buffers.front()); i++)
+        buffer = frames[i + 1];
+    mutex.unlock();
+
+    // Draw the top and bottom screens, clearing the borders around the bottom one
+    drawScreen(0, &buffer[0], data[0]);
+    drawScreen(1, &buffer[240 * 400 + 40], data[1]);
+    for (int y = 240; y < 480; y++) {
+        memset(&buffer[y * 400], 0, 40 * sizeof(uint32_t));
+        memset(&buffer[y * 400 + 360], 0, 40 * sizeof(uint32_t));
+    }
 
     // Add the frame to the queue
     mutex.lock();
@@ -133,6 +201,14 @@ void Pdc::drawFrame() {
     mutex.unlock();
 }
 
+bool Pdc::isFramebuf(uint32_t address) {
+    // Check if an address is the start of any framebuffer the screens can display
+    for (int i = 0; i < 2; i++)
+        if (pdcFramebufLt0[i] == address || pdcFramebufLt1[i] == address)
+            return true;
+    return false;
+}
+
 void Pdc::writeFramebufLt0(int i, uint32_t mask, uint32_t value) {
     // Write to a screen's PDC_FRAMEBUF_LT0 register
     mask &= 0xFFFFFFF0;
@@ -20,9 +20,13 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <queue>
 #include <mutex>
+#include <vector>
+
+#define MAX_SCREEN_SIZE 0x400000
 
 class Core;
 
@@ -31,6 +35,7 @@ public:
     Pdc(Core *core): core(core) {}
     uint32_t *getFrame();
     void drawFrame();
+    bool isFramebuf(uint32_t address);
 
     uint32_t readFramebufLt0(int i) { return pdcFramebufLt0[i]; }
     uint32_t readFramebufLt1(int i) { return pdcFramebufLt1[i]; }
@@ -49,10 +54,25 @@ public:
 private:
     Core *core;
 
+    static const uint8_t expand4[0x10];
+    static const uint8_t expand5[0x20];
+    static const uint8_t expand6[0x40];
+
+    uint32_t frames[3][400 * 480] = {};
     std::queue<uint32_t*> buffers;
+    uint32_t *held = nullptr;
+    std::vector<uint8_t> stage[2];
+    std::vector<uint8_t> lastData[2];
+    uint32_t lastConfig[2][4] = { { 0, 0, 0, UINT32_MAX }, { 0, 0, 0, UINT32_MAX } }; // Step can't match
     std::atomic<bool> ready{false};
     std::mutex mutex;
     uint32_t screenBases[2] = {};
+    uint32_t nextBases[2] = {};
+
+    std::chrono::steady_clock::time_point lastFrameTime;
+    float frameDebt = 0;
+    int skipCount = 0;
+    bool skipped[2] = {};
 
     uint32_t pdcFramebufLt0[2] = {};
     uint32_t pdcFramebufLt1[2] = {};
@@ -61,5 +81,8 @@ private:
     uint32_t pdcFramebufSelAck[2] = {};
     uint32_t pdcFramebufStep[2] = {};
 
-    void drawScreen(int i, uint32_t *buffer);
+    template <int fmt> static void drawPixels(uint32_t *buffer, const uint8_t *data, int width, uint32_t step);
+    bool checkSkip();
+    const uint8_t *getScreen(int i, uint32_t &size);
+    void drawScreen(int i, uint32_t *buffer, const uint8_t *data);
 };
@@ -168,12 +168,27 @@ void Memory::updateMap(bool arm9, uint32_t start, uint32_t end) {
             write = &boot11[address & 0xFFFF];
     }
 
-    // Update the virtual memory maps as well
+    // Update the virtual memory maps as well and let cached host pointers know
+    mapVersion++;
     if (arm9) return core->cp15.updateMap9(start, end);
     for (int i = 0; i < MAX_CPUS - 1; i++)
         core->cp15.mmuInvalidate(CpuId(i));
 }
 
+uint8_t *Memory::getHostPtr(uint32_t address, uint32_t size, bool write) {
+    // Get a host pointer to the start of an ARM11 memory range if it's mapped
+    uint8_t *base = readMap11[address >> 12];
+    if (!base || !size || uint64_t(address) + size > 0x100000000) return nullptr;
+
+    // Ensure every page in the range is contiguous in host memory, or fall back to null
+    for (uint64_t page = address & ~0xFFF; page < uint64_t(address) + size; page += 0x1000) {
+        uint8_t *data = base + (page - (address & ~0xFFF));
+        if (readMap11[page >> 12] != data || (write && writeMap11[page >> 12] != data))
+            return nullptr;
+    }
+    return base + (address & 0xFFF);
+}
+
 template <typename T> T Memory::readFallback(CpuId id, uint32_t address) {
     // Forward a read to I/O registers if within range
     if (address >= 0x10000000 && address < 0x18000000)
@@ -3273,6 +3288,10 @@ template <typename T> void Memory::ioWrite(CpuId id, uint32_t address, T value)
         // Loop until the full value has been written
         i += size - base;
     }
+
+    // Let the GPU know when its internal registers are written directly
+    if (id != ARM9 && (address >> 12) == 0x10401)
+        core->gpu.writeIoCmd((address >> 2) & 0x3FF);
 }
 
 uint32_t Memory::readPrngSource(int i) {
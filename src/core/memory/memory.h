@@ -29,6 +29,7 @@ public:
     uint8_t *writeMap11[0x100000] = {};
     uint8_t *readMap9[0x100000] = {};
     uint8_t *writeMap9[0x100000] = {};
+    uint32_t mapVersion = 0;
 
     Memory(Core *core): core(core) {}
     ~Memory();
@@ -36,6 +37,7 @@ public:
     bool init();
     void loadOtp(FILE *file);
     void updateMap(bool arm9, uint32_t start, uint32_t end);
+    uint8_t *getHostPtr(uint32_t address, uint32_t size, bool write);
 
     template <typename T> T read(CpuId id, uint32_t address);
     template <typename T> void write(CpuId id, uint32_t address, T value);
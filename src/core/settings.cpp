@@ -24,7 +24,10 @@ namespace Settings {
     int fpsLimiter = 1;
     int cartAutoBoot = 0;
     int threadedGpu = 0;
+    int threadedVerts = 0;
     int gpuRenderer = 0;
+    int frameSkip = 0;
+    int gpuStats = 0;
     std::string boot11Path = "boot11.bin";
     std::string boot9Path = "boot9.bin";
     std::string nandPath = "nand.bin";
@@ -35,7 +38,10 @@ namespace Settings {
         Setting("fpsLimiter", &fpsLimiter, false),
         Setting("cartAutoBoot", &cartAutoBoot, false),
         Setting("threadedGpu", &threadedGpu, false),
+        Setting("threadedVerts", &threadedVerts, false),
         Setting("gpuRenderer", &gpuRenderer, false),
+        Setting("frameSkip", &frameSkip, false),
+        Setting("gpuStats", &gpuStats, false),
         Setting("boot11Path", &boot11Path, true),
         Setting("boot9Path", &boot9Path, true),
         Setting("nandPath", &nandPath, true),
@@ -35,7 +35,10 @@ namespace Settings {
     extern int fpsLimiter;
     extern int cartAutoBoot;
     extern int threadedGpu;
+    extern int threadedVerts;
     extern int gpuRenderer;
+    extern int frameSkip;
+    extern int gpuStats;
     extern std::string boot11Path;
     extern std::string boot9Path;
     extern std::string nandPath;
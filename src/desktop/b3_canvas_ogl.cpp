@@ -144,7 +144,6 @@ void b3CanvasOgl::draw(wxPaintEvent &event) {
     // Upload a new framebuffer texture if one is available
     if (uint32_t *fb = frame->getFrame()) {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 400, 480, 0, GL_RGBA, GL_UNSIGNED_BYTE, fb);
-        delete[] fb;
     }
 
     // Define vertices for the screen
@@ -53,19 +53,25 @@ void b3CanvasSoft::draw(wxPaintEvent &event) {
             }
             iter.OffsetY(data, 1);
         }
-        delete[] fb;
+        dirty = true;
     }
 
-    // Scale the bitmap and draw it
+    // Rescale the bitmap only if its contents or the layout changed
+    if (dirty) {
+        wxImage image = bitmap.ConvertToImage();
+        image.Rescale(scrW, scrH, wxIMAGE_QUALITY_BILINEAR);
+        scaled = wxBitmap(image);
+        dirty = false;
+    }
+
+    // Draw the scaled bitmap
     wxPaintDC dc(this);
-    wxImage image = bitmap.ConvertToImage();
-    image.Rescale(scrW, scrH, wxIMAGE_QUALITY_BILINEAR);
-    wxBitmap scaled = wxBitmap(image);
     dc.DrawBitmap(scaled, wxPoint(scrX, scrY));
 }
 
 void b3CanvasSoft::resize(wxSizeEvent &event) {
     // Set the layout to be centered and as large as possible
+    dirty = true;
     wxSize size = GetSize();
     if ((float(size.x) / size.y) > (400.0f / 480)) { // Wide
         scrW = (400.0f * size.y) / 480;
@@ -30,6 +30,8 @@ public:
 private:
     b3Frame *frame;
     wxBitmap bitmap;
+    wxBitmap scaled;
+    bool dirty = true;
 
     int scrW = 0, scrH = 0;
     int scrX = 0, scrY = 0;
@@ -30,11 +30,19 @@ enum FrameEvent {
     PAUSE,
     RESTART,
     STOP,
+    GPU_TRACE,
     FPS_LIMITER,
     CART_AUTO_BOOT,
     THREADED_GPU,
+    THREADED_VERTS,
     GPU_RENDER_SOFT,
     GPU_RENDER_OGL,
+    FRAME_SKIP_0,
+    FRAME_SKIP_1,
+    FRAME_SKIP_2,
+    FRAME_SKIP_3,
+    FRAME_SKIP_AUTO,
+    GPU_STATS,
     PATH_SETTINGS,
     INPUT_BINDINGS,
     UPDATE_JOYSTICK
@@ -47,11 +55,19 @@ EVT_MENU(QUIT, b3Frame::quit)
 EVT_MENU(PAUSE, b3Frame::pause)
 EVT_MENU(RESTART, b3Frame::restart)
 EVT_MENU(STOP, b3Frame::stop)
+EVT_MENU(GPU_TRACE, b3Frame::gpuTrace)
 EVT_MENU(FPS_LIMITER, b3Frame::fpsLimiter)
 EVT_MENU(CART_AUTO_BOOT, b3Frame::cartAutoBoot)
 EVT_MENU(THREADED_GPU, b3Frame::threadedGpu)
+EVT_MENU(THREADED_VERTS, b3Frame::threadedVerts)
 EVT_MENU(GPU_RENDER_SOFT, b3Frame::gpuRenderer<0>)
 EVT_MENU(GPU_RENDER_OGL, b3Frame::gpuRenderer<1>)
+EVT_MENU(FRAME_SKIP_0, b3Frame::frameSkip<0>)
+EVT_MENU(FRAME_SKIP_1, b3Frame::frameSkip<1>)
+EVT_MENU(FRAME_SKIP_2, b3Frame::frameSkip<2>)
+EVT_MENU(FRAME_SKIP_3, b3Frame::frameSkip<3>)
+EVT_MENU(FRAME_SKIP_AUTO, b3Frame::frameSkip<4>)
+EVT_MENU(GPU_STATS, b3Frame::gpuStats)
 EVT_MENU(PATH_SETTINGS, b3Frame::pathSettings)
 EVT_MENU(INPUT_BINDINGS, b3Frame::inputBindings)
 EVT_TIMER(UPDATE_JOYSTICK, b3Frame::updateJoystick)
@@ -72,19 +88,32 @@ b3Frame::b3Frame(): wxFrame(nullptr, wxID_ANY, "3Beans") {
     systemMenu->Append(PAUSE, "&Pause");
     systemMenu->Append(RESTART, "&Restart");
     systemMenu->Append(STOP, "&Stop");
+    systemMenu->AppendSeparator();
+    systemMenu->Append(GPU_TRACE, "Start &GPU Trace");
 
     // Set up the renderer submenu
     wxMenu *renderMenu = new wxMenu();
     renderMenu->AppendRadioItem(GPU_RENDER_SOFT, "&Software");
     renderMenu->AppendRadioItem(GPU_RENDER_OGL, "&OpenGL");
 
+    // Set up the frameskip submenu
+    wxMenu *skipMenu = new wxMenu();
+    skipMenu->AppendRadioItem(FRAME_SKIP_0, "&None");
+    skipMenu->AppendRadioItem(FRAME_SKIP_1, "&1 Frame");
+    skipMenu->AppendRadioItem(FRAME_SKIP_2, "&2 Frames");
+    skipMenu->AppendRadioItem(FRAME_SKIP_3, "&3 Frames");
+    skipMenu->AppendRadioItem(FRAME_SKIP_AUTO, "&Automatic");
+
     // Set up the settings menu
     wxMenu *settingsMenu = new wxMenu();
     settingsMenu->AppendCheckItem(FPS_LIMITER, "&FPS Limiter");
     settingsMenu->AppendCheckItem(CART_AUTO_BOOT, "&Cart Auto-Boot");
     settingsMenu->AppendSeparator();
     settingsMenu->AppendCheckItem(THREADED_GPU, "&Threaded GPU");
+    settingsMenu->AppendCheckItem(THREADED_VERTS, "Threaded &Vertices");
     settingsMenu->AppendSubMenu(renderMenu, "&GPU Renderer");
+    settingsMenu->AppendSubMenu(skipMenu, "&Frameskip");
+    settingsMenu->AppendCheckItem(GPU_STATS, "GPU &Statistics");
     settingsMenu->AppendSeparator();
     settingsMenu->Append(PATH_SETTINGS, "&Path Settings");
     settingsMenu->Append(INPUT_BINDINGS, "&Input Bindings");
@@ -125,7 +154,10 @@ b3Frame::b3Frame(): wxFrame(nullptr, wxID_ANY, "3Beans") {
     settingsMenu->Check(FPS_LIMITER, Settings::fpsLimiter);
     settingsMenu->Check(CART_AUTO_BOOT, Settings::cartAutoBoot);
     settingsMenu->Check(THREADED_GPU, Settings::threadedGpu);
+    settingsMenu->Check(THREADED_VERTS, Settings::threadedVerts);
     renderMenu->Check(GPU_RENDER_SOFT + std::min(Settings::gpuRenderer, 1), true);
+    skipMenu->Check(FRAME_SKIP_0 + std::min(Settings::frameSkip, 4), true);
+    settingsMenu->Check(GPU_STATS, Settings::gpuStats);
 
     // Prepare a joystick if one is connected
     joystick = new wxJoystick();
@@ -154,8 +186,20 @@ void b3Frame::Refresh() {
     // Display current FPS in the title bar if running
     wxString label = "3Beans";
     mutex.lock();
-    if (running.load())
+    if (running.load()) {
         label += wxString::Format(" - %d FPS", core->fps);
+
+        // Display per-frame GPU averages as well if enabled, with times in milliseconds
+        if (Settings::gpuStats) {
+            label += wxString::Format(" - %llu verts (%llu cached), %llu tris (%llu culled), %llu frags, %llu texels",
+                (unsigned long long)core->getGpuStat(STAT_VERTS), (unsigned long long)core->getGpuStat(STAT_VTX_HITS),
+                (unsigned long long)core->getGpuStat(STAT_TRIS), (unsigned long long)core->getGpuStat(STAT_CULLED),
+                (unsigned long long)core->getGpuStat(STAT_FRAGS), (unsigned long long)core->getGpuStat(STAT_TEXELS));
+            label += wxString::Format(" - %.2f ms shade, %.2f ms draw, %.2f ms fill/copy",
+                core->getGpuStat(STAT_SHADE_TIME) / 1000000.0, core->getGpuStat(STAT_DRAW_TIME) / 1000000.0,
+                core->getGpuStat(STAT_XFER_TIME) / 1000000.0);
+        }
+    }
     mutex.unlock();
     SetLabel(label);
 }
@@ -195,6 +239,7 @@ void b3Frame::startCore(bool full) {
     systemMenu->SetLabel(RESTART, "&Restart");
     systemMenu->Enable(PAUSE, true);
     systemMenu->Enable(STOP, true);
+    systemMenu->Enable(GPU_TRACE, true);
 }
 
 void b3Frame::stopCore(bool full) {
@@ -211,6 +256,9 @@ void b3Frame::stopCore(bool full) {
     systemMenu->SetLabel(RESTART, "&Start");
     systemMenu->Enable(PAUSE, false);
     systemMenu->Enable(STOP, false);
+    systemMenu->Enable(GPU_TRACE, false);
+    systemMenu->SetLabel(GPU_TRACE, "Start &GPU Trace");
+    tracing = false;
 
     // Fully stop and remove the core
     mutex.lock();
@@ -235,18 +283,11 @@ uint32_t *b3Frame::getFrame() {
     if (++frameCount < swapInterval)
         return nullptr;
 
-    // Get a new frame from the core, or make an empty one if inactive
-    uint32_t *frame;
+    // Get a new frame from the core, or an empty one if inactive
+    static uint32_t empty[400 * 480] = {};
     mutex.lock();
-    if (core) {
-        frame = core->pdc.getFrame();
-        mutex.unlock();
-    }
-    else {
-        mutex.unlock();
-        frame = new uint32_t[400 * 480];
-        memset(frame, 0, 400 * 480 * sizeof(uint32_t));
-    }
+    uint32_t *frame = core ? core->pdc.getFrame() : empty;
+    mutex.unlock();
     frameCount = 0;
     return frame;
 }
@@ -356,6 +397,19 @@ void b3Frame::stop(wxCommandEvent &event) {
     stopCore(true);
 }
 
+void b3Frame::gpuTrace(wxCommandEvent &event) {
+    // Start or stop capturing GPU commands to a trace file for offline replay
+    mutex.lock();
+    if (core) {
+        if ((tracing = !tracing))
+            core->gpu.startTrace(Settings::basePath + "/trace.bin");
+        else
+            core->gpu.stopTrace();
+    }
+    mutex.unlock();
+    systemMenu->SetLabel(GPU_TRACE, tracing ? "Stop &GPU Trace" : "Start &GPU Trace");
+}
+
 void b3Frame::fpsLimiter(wxCommandEvent &event) {
     // Toggle the FPS limiter setting
     Settings::fpsLimiter = !Settings::fpsLimiter;
@@ -374,12 +428,30 @@ void b3Frame::threadedGpu(wxCommandEvent &event) {
     Settings::save();
 }
 
+void b3Frame::threadedVerts(wxCommandEvent &event) {
+    // Toggle the threaded vertices setting
+    Settings::threadedVerts = !Settings::threadedVerts;
+    Settings::save();
+}
+
+void b3Frame::gpuStats(wxCommandEvent &event) {
+    // Toggle the GPU statistics setting
+    Settings::gpuStats = !Settings::gpuStats;
+    Settings::save();
+}
+
 template <int i> void b3Frame::gpuRenderer(wxCommandEvent &event) {
     // Set the GPU renderer to a specific value
     Settings::gpuRenderer = i;
     Settings::save();
 }
 
+template <int i> void b3Frame::frameSkip(wxCommandEvent &event) {
+    // Set the frameskip mode to a specific value
+    Settings::frameSkip = i;
+    Settings::save();
+}
+
 void b3Frame::pathSettings(wxCommandEvent &event) {
     // Show the path settings dialog
     PathDialog pathDialog;
@@ -59,6 +59,7 @@ private:
     int swapInterval = 0;
     int refreshRate = 0;
     bool glSupport = true;
+    bool tracing = false;
 
     void runCore();
     void startCore(bool full);
@@ -71,10 +72,14 @@ private:
     void pause(wxCommandEvent &event);
     void restart(wxCommandEvent &event);
     void stop(wxCommandEvent &event);
+    void gpuTrace(wxCommandEvent &event);
     void fpsLimiter(wxCommandEvent &event);
     void cartAutoBoot(wxCommandEvent &event);
     void threadedGpu(wxCommandEvent &event);
+    void threadedVerts(wxCommandEvent &event);
     template <int i> void gpuRenderer(wxCommandEvent &event);
+    template <int i> void frameSkip(wxCommandEvent &event);
+    void gpuStats(wxCommandEvent &event);
     void pathSettings(wxCommandEvent &event);
     void inputBindings(wxCommandEvent &event);
     void updateJoystick(wxTimerEvent &event);
@@ -37,6 +37,9 @@ static ScreenLayout layout;
 
 static std::vector<uint32_t> videoBuffer;
 static uint32_t videoBufferSize;
+static uint32_t *lastFrame;
+static bool videoDirty;
+static bool canDupe;
 
 static std::string touchMode;
 static std::string screenSwapMode;
@@ -56,6 +59,8 @@ static int lastMouseY = 0;
 static int touchX = 0;
 static int touchY = 0;
 
+static int statFrames = 0;
+
 static int keymap[] = {
   RETRO_DEVICE_ID_JOYPAD_A,
   RETRO_DEVICE_ID_JOYPAD_B,
@@ -216,6 +221,9 @@ static void initConfig()
     { "3beans_cartAutoBoot", "Cart Auto Boot; enabled|disabled" },
     { "3beans_fpsLimiter", "FPS Limiter; enabled|disabled" },
     { "3beans_threadedGpu", "Threaded GPU; disabled|enabled" },
+    { "3beans_threadedVerts", "Threaded Vertices; disabled|enabled" },
+    { "3beans_frameSkip", "Frameskip; disabled|1|2|3|auto" },
+    { "3beans_gpuStats", "GPU Statistics; disabled|enabled" },
     { "3beans_screenArrangement", "Screen Arrangement; Vertical|Horizontal|Single Screen" },
     { "3beans_screenSizing", "Screen Sizing; Default|Enlarge Top|Enlarge Bottom" },
     { "3beans_screenPosition", "Screen Position; Center|Start|End" },
@@ -240,6 +248,9 @@ static void updateConfig()
   Settings::cartAutoBoot = fetchVariableBool("3beans_cartAutoBoot", true);
   Settings::fpsLimiter = fetchVariableBool("3beans_fpsLimiter", true);
   Settings::threadedGpu = fetchVariableBool("3beans_threadedGpu", false);
+  Settings::threadedVerts = fetchVariableBool("3beans_threadedVerts", false);
+  Settings::frameSkip = fetchVariableEnum("3beans_frameSkip", {"disabled", "1", "2", "3", "auto"});
+  Settings::gpuStats = fetchVariableBool("3beans_gpuStats", false);
 
   ScreenLayout::screenArrangement = fetchVariableEnum("3beans_screenArrangement", {"Vertical", "Horizontal", "Single Screen"});
   ScreenLayout::screenSizing = fetchVariableEnum("3beans_screenSizing", {"Default", "Enlarge Top", "Enlarge Bottom"});
@@ -264,6 +275,7 @@ static void updateScreen()
   }
 
   memset(videoBuffer.data(), 0, videoBuffer.size() * sizeof(videoBuffer[0]));
+  videoDirty = true;
 
   retro_system_av_info info;
   retro_get_system_av_info(&info);
@@ -365,8 +377,31 @@ static void renderVideo()
 {
   static uint32_t bufferTop[400 * 240];
   static uint32_t bufferBot[320 * 240];
+  static int lastCursor[3];
 
   if (uint32_t *frame = core->pdc.getFrame())
+  {
+    lastFrame = frame;
+    videoDirty = true;
+  }
+
+  int cursor[] = { showTouchCursor && cursorVisible, touchX, touchY };
+
+  if (memcmp(cursor, lastCursor, sizeof(cursor)))
+  {
+    memcpy(lastCursor, cursor, sizeof(cursor));
+    videoDirty = true;
+  }
+
+  uint32_t stride = layout.minWidth * 4;
+
+  if (!videoDirty && canDupe)
+  {
+    videoCallback(NULL, layout.minWidth, layout.minHeight, stride);
+    return;
+  }
+
+  if (uint32_t *frame = videoDirty ? lastFrame : nullptr)
   {
     if (ScreenLayout::renderTopScreen)
     {
@@ -399,11 +434,9 @@ static void renderVideo()
       if (showTouchCursor && cursorVisible)
         drawCursor(videoBuffer.data(), touchX, touchY);
     }
-
-    delete[] frame;
   }
 
-  uint32_t stride = layout.minWidth * 4;
+  videoDirty = false;
   videoCallback(videoBuffer.data(), layout.minWidth, layout.minHeight, stride);
 }
 
@@ -424,6 +457,32 @@ static void renderAudio()
   audioBatchCallback(buffer, size);
 }
 
+static void logGpuStats()
+{
+  if (!Settings::gpuStats || ++statFrames < 60)
+    return;
+
+  statFrames = 0;
+
+  auto stat = [](GpuStat s) { return (unsigned long long)core->getGpuStat(s); };
+
+  logCallback(RETRO_LOG_INFO,
+    "GPU per frame: %llu commands (%llu skipped), %llu vertices (%llu cached), %llu shader instructions\n",
+    stat(STAT_CMDS), stat(STAT_SKIPS), stat(STAT_VERTS), stat(STAT_VTX_HITS), stat(STAT_INSTRS));
+
+  logCallback(RETRO_LOG_INFO,
+    "GPU per frame: %llu triangles (%llu culled, %llu clipped), %llu fragments (%llu depth pass, %llu stencil pass)\n",
+    stat(STAT_TRIS), stat(STAT_CULLED), stat(STAT_CLIPPED), stat(STAT_FRAGS), stat(STAT_DEPTH_PASS), stat(STAT_STENCIL_PASS));
+
+  logCallback(RETRO_LOG_INFO,
+    "GPU per frame: %llu texels (%llu cached), %llu fill bytes, %llu copy bytes\n",
+    stat(STAT_TEXELS), stat(STAT_TEX_HITS), stat(STAT_FILL_BYTES), stat(STAT_COPY_BYTES));
+
+  logCallback(RETRO_LOG_INFO,
+    "GPU per frame: %.3f ms shading, %.3f ms drawing, %.3f ms filling/copying\n",
+    stat(STAT_SHADE_TIME) / 1000000.0, stat(STAT_DRAW_TIME) / 1000000.0, stat(STAT_XFER_TIME) / 1000000.0);
+}
+
 static void updateCursorState()
 {
   if (showTouchCursor && cursorTimeout)
@@ -448,6 +507,7 @@ static bool createCore(std::string cartPath = "")
   {
     if (core) delete core;
 
+    lastFrame = nullptr;
     core = new Core(cartPath, nullptr);
     return true;
   }
@@ -524,6 +584,9 @@ void retro_init(void)
   else
     logCallback = logFallback;
 
+  if (!envCallback(RETRO_ENVIRONMENT_GET_CAN_DUPE, &canDupe))
+    canDupe = false;
+
   systemPath = normalizePath(getSystemDir(), true);
   savesPath = normalizePath(getSaveDir(), true);
 }
@@ -556,6 +619,7 @@ bool retro_load_game_special(unsigned type, const struct retro_game_info* info,
 
 void retro_unload_game(void)
 {
+  lastFrame = nullptr;
   if (core) delete core;
 }
 
@@ -687,6 +751,7 @@ void retro_run(void)
 
   renderVideo();
   renderAudio();
+  logGpuStats();
 }
 
 void retro_set_controller_port_device(unsigned port, unsigned device)
@@ -0,0 +1,121 @@
+/*
+    Copyright 2023-2025 Hydr8gon
+
+    This file is part of 3Beans.
+
+    3Beans is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    3Beans is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with 3Beans. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <epoxy/gl.h>
+#if !defined(WINDOWS) && !defined(MACOS)
+#include <epoxy/egl.h>
+#endif
+
+#include "../core/core.h"
+
+static bool createContext() {
+#if defined(WINDOWS) || defined(MACOS)
+    // Offscreen contexts are only set up through EGL for now
+    return false;
+#else
+    // Initialize EGL and pick a config that supports desktop OpenGL
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) return false;
+    EGLint cfgAttrs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = nullptr;
+    EGLint count = 0;
+    eglChooseConfig(display, cfgAttrs, &config, 1, &count);
+    eglBindAPI(EGL_OPENGL_API);
+
+    // Create an OpenGL 3.3 context and make it current without a surface, since nothing is displayed
+    EGLint ctxAttrs[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext context = eglCreateContext(display, count ? config : nullptr, EGL_NO_CONTEXT, ctxAttrs);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+#endif
+}
+
+int main(int argc, char **argv) {
+    // Parse options and the trace path from the command line
+    std::string tracePath, settingsPath = ".";
+    bool ogl = false;
+    int passes = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--ogl"))
+            ogl = true;
+        else if (!strcmp(argv[i], "--passes") && i + 1 < argc)
+            passes = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--settings") && i + 1 < argc)
+            settingsPath = argv[++i];
+        else
+            tracePath = argv[i];
+    }
+    if (tracePath.empty()) {
+        printf("Usage: %s [--ogl] [--passes count] [--settings path] trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    // Load settings for the boot ROM paths and run the chosen renderer on this thread
+    Settings::load(settingsPath);
+    Settings::gpuRenderer = ogl;
+    Settings::threadedGpu = 0;
+    if (ogl && !createContext()) {
+        printf("Failed to create an offscreen OpenGL context\n");
+        return 1;
+    }
+
+    // Create a core for its memory and GPU, leaving the context current since no CPUs will run
+    std::function<void()> contextFunc = []() {};
+    std::string cartPath;
+    Core *core;
+    try {
+        core = new Core(cartPath, &contextFunc);
+    }
+    catch (CoreError e) {
+        printf("One of the boot ROMs is missing! Check the paths in %s/3beans.ini.\n", settingsPath.c_str());
+        return 1;
+    }
+
+    // Replay the trace for each pass, timing every frame
+    for (int i = 0; i < passes; i++) {
+        if (!core->gpu.openReplay(tracePath)) {
+            printf("Failed to open GPU trace: %s\n", tracePath.c_str());
+            delete core;
+            return 1;
+        }
+
+        int frames = 0;
+        double total = 0, worst = 0;
+        while (true) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (!core->gpu.replayFrame()) break;
+            if (ogl) glFinish();
+            std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+            total += time.count();
+            worst = std::max(worst, time.count());
+            frames++;
+        }
+
+        // Report the results of the pass
+        printf("Pass %d: %d frames, %.3f ms average, %.3f ms worst\n",
+            i + 1, frames, frames ? (total / frames) : 0.0, worst);
+    }
+
+    delete core;
+    return 0;
+}